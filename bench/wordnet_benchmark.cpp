@@ -0,0 +1,330 @@
+/**
+ * Benchmarks of WordNet loading and queries.
+ *
+ * Build against Google Benchmark from the repository root:
+ *
+ *     g++ -std=c++17 -O2 -DNDEBUG -pthread -Iinclude bench/wordnet_benchmark.cpp src/wordnet.cpp \
+ *         -lbenchmark -o wordnet_benchmark
+ *
+ * The synsets and hypernyms files are taken from WORDNET_SYNSETS and
+ * WORDNET_HYPERNYMS (synsets.txt and hypernyms.txt in the working directory
+ * by default). Query inputs are drawn with a fixed seed, so runs over the same
+ * files are comparable. Every benchmark reports heap allocations per iteration
+ * and the peak resident set size of the process so far.
+ */
+
+#include "wordnet.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+namespace {
+
+std::atomic<std::size_t> allocation_count{0};
+
+// every replaced operator new allocates through these, and every operator delete frees with std::free
+void * counted_allocation(std::size_t size, std::size_t alignment) noexcept
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    size = std::max<std::size_t>(size, 1);
+    if (alignment <= alignof(std::max_align_t)) {
+        return std::malloc(size);
+    }
+    // aligned_alloc wants a size that is a multiple of the alignment
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void * counted_allocation_or_throw(std::size_t size, std::size_t alignment)
+{
+    if (void * p = counted_allocation(size, alignment)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+} // namespace
+
+void * operator new(std::size_t size)
+{
+    return counted_allocation_or_throw(size, alignof(std::max_align_t));
+}
+
+void * operator new[](std::size_t size)
+{
+    return counted_allocation_or_throw(size, alignof(std::max_align_t));
+}
+
+void * operator new(std::size_t size, std::align_val_t alignment)
+{
+    return counted_allocation_or_throw(size, static_cast<std::size_t>(alignment));
+}
+
+void * operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return counted_allocation_or_throw(size, static_cast<std::size_t>(alignment));
+}
+
+void * operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    return counted_allocation(size, alignof(std::max_align_t));
+}
+
+void * operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return counted_allocation(size, alignof(std::max_align_t));
+}
+
+void * operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return counted_allocation(size, static_cast<std::size_t>(alignment));
+}
+
+void * operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return counted_allocation(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void * p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void * p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void * p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void * p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void * p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void * p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void * p, std::size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void * p, std::size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void * p, const std::nothrow_t &) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void * p, const std::nothrow_t &) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void * p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void * p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+
+std::string env_or(const char * name, const char * fallback)
+{
+    const char * value = std::getenv(name);
+    return value != nullptr ? value : fallback;
+}
+
+const std::string & synsets_path()
+{
+    static const std::string path = env_or("WORDNET_SYNSETS", "synsets.txt");
+    return path;
+}
+
+const std::string & hypernyms_path()
+{
+    static const std::string path = env_or("WORDNET_HYPERNYMS", "hypernyms.txt");
+    return path;
+}
+
+// WordNet shared by all query benchmarks, loaded on first use
+WordNet & shared_wordnet()
+{
+    static WordNet wordnet = WordNet::from_files(synsets_path(), hypernyms_path());
+    return wordnet;
+}
+
+// all nouns of the shared WordNet, sorted by depth
+const std::vector<std::string> & nouns_by_depth()
+{
+    static const std::vector<std::string> nouns = [] {
+        const WordNet & wordnet = shared_wordnet();
+        std::vector<std::string> result;
+        for (const std::string_view noun : wordnet.nouns()) {
+            result.emplace_back(noun);
+        }
+        std::stable_sort(result.begin(), result.end(), [&wordnet](const std::string & lhs, const std::string & rhs) {
+            return wordnet.depth(lhs) < wordnet.depth(rhs);
+        });
+        return result;
+    }();
+    return nouns;
+}
+
+enum class PairKind
+{
+    random,  // both nouns from the whole dictionary
+    deep,    // both nouns from the deepest tenth
+    shallow, // both nouns from the shallowest tenth
+};
+
+std::vector<std::pair<std::string, std::string>> make_pairs(PairKind kind, std::size_t count)
+{
+    const std::vector<std::string> & nouns = nouns_by_depth();
+    std::size_t first = 0;
+    std::size_t size = nouns.size();
+    if (kind != PairKind::random) {
+        size = std::max<std::size_t>(1, nouns.size() / 10);
+        first = kind == PairKind::deep ? nouns.size() - size : 0;
+    }
+    std::mt19937 random(42);
+    std::uniform_int_distribution<std::size_t> pick(first, first + size - 1);
+    std::vector<std::pair<std::string, std::string>> result;
+    for (std::size_t i = 0; i < count; ++i) {
+        result.emplace_back(nouns[pick(random)], nouns[pick(random)]);
+    }
+    return result;
+}
+
+// adds allocation and memory counters to a benchmark; create it after setup, right before the timing loop
+class MemoryCounters
+{
+public:
+    explicit MemoryCounters(benchmark::State & state)
+        : state(state)
+        , allocations_before(allocation_count.load(std::memory_order_relaxed))
+    {
+    }
+
+    ~MemoryCounters()
+    {
+        const std::size_t allocations = allocation_count.load(std::memory_order_relaxed) - allocations_before;
+        state.counters["allocs/op"] = benchmark::Counter(allocations, benchmark::Counter::kAvgIterations);
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        state.counters["peak_rss_kb"] = usage.ru_maxrss;
+    }
+
+private:
+    benchmark::State & state;
+    std::size_t allocations_before;
+};
+
+void BM_LoadFromFiles(benchmark::State & state)
+{
+    MemoryCounters counters(state);
+    for (auto _ : state) {
+        WordNet wordnet = WordNet::from_files(synsets_path(), hypernyms_path());
+        benchmark::DoNotOptimize(wordnet.is_noun("entity"));
+    }
+}
+BENCHMARK(BM_LoadFromFiles)->Unit(benchmark::kMillisecond);
+
+void BM_Distance(benchmark::State & state)
+{
+    const WordNet & wordnet = shared_wordnet();
+    const auto pairs = make_pairs(static_cast<PairKind>(state.range(0)), 4096);
+    std::size_t i = 0;
+    MemoryCounters counters(state);
+    for (auto _ : state) {
+        const auto & [noun1, noun2] = pairs[i++ % pairs.size()];
+        benchmark::DoNotOptimize(wordnet.distance(noun1, noun2));
+    }
+}
+BENCHMARK(BM_Distance)
+        ->ArgName("kind")
+        ->Arg(static_cast<int>(PairKind::random))
+        ->Arg(static_cast<int>(PairKind::deep))
+        ->Arg(static_cast<int>(PairKind::shallow));
+
+void BM_Sca(benchmark::State & state)
+{
+    const WordNet & wordnet = shared_wordnet();
+    const auto pairs = make_pairs(static_cast<PairKind>(state.range(0)), 4096);
+    std::size_t i = 0;
+    MemoryCounters counters(state);
+    for (auto _ : state) {
+        const auto & [noun1, noun2] = pairs[i++ % pairs.size()];
+        benchmark::DoNotOptimize(wordnet.sca(noun1, noun2));
+    }
+}
+BENCHMARK(BM_Sca)
+        ->ArgName("kind")
+        ->Arg(static_cast<int>(PairKind::random))
+        ->Arg(static_cast<int>(PairKind::deep))
+        ->Arg(static_cast<int>(PairKind::shallow));
+
+void BM_Outcast(benchmark::State & state)
+{
+    const Outcast outcast(shared_wordnet());
+    const std::vector<std::string> & nouns = nouns_by_depth();
+    std::mt19937 random(42);
+    std::vector<std::set<std::string>> inputs(64);
+    for (std::set<std::string> & input : inputs) {
+        while (input.size() < static_cast<std::size_t>(state.range(0))) {
+            input.insert(nouns[random() % nouns.size()]);
+        }
+    }
+    std::size_t i = 0;
+    MemoryCounters counters(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(outcast.outcast(inputs[i++ % inputs.size()]));
+    }
+}
+BENCHMARK(BM_Outcast)->ArgName("words")->Arg(5)->Arg(20)->Arg(100);
+
+void BM_NounsIteration(benchmark::State & state)
+{
+    const WordNet & wordnet = shared_wordnet();
+    MemoryCounters counters(state);
+    for (auto _ : state) {
+        std::size_t length = 0;
+        for (const std::string_view noun : wordnet.nouns()) {
+            length += noun.size();
+        }
+        benchmark::DoNotOptimize(length);
+    }
+}
+BENCHMARK(BM_NounsIteration)->Unit(benchmark::kMicrosecond);
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -1,95 +1,1039 @@
+#include <array>
 #include <cstddef>
+#include <cstdint>
 #include <iosfwd>
 #include <iterator>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <stdexcept>
 #include <string>
 #include <string_view>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
+/**
+ * Read-only array that either owns its elements or refers to elements owned
+ * elsewhere, e.g. by a memory-mapped snapshot.
+ */
+template <class T>
+class FlatArray
+{
+public:
+    FlatArray() = default;
+
+    FlatArray(std::vector<T> && elements)
+        : owned(std::move(elements))
+        , first(owned.data())
+        , count(owned.size())
+    {
+    }
+
+    FlatArray(const FlatArray & other)
+        : owned(other.owned)
+        , first(other.owned.empty() ? other.first : owned.data())
+        , count(other.count)
+    {
+    }
+
+    FlatArray(FlatArray && other) noexcept
+        : owned(std::move(other.owned))
+        , first(other.first)
+        , count(other.count)
+    {
+        other.first = nullptr;
+        other.count = 0;
+    }
+
+    FlatArray & operator=(FlatArray other) noexcept
+    {
+        owned.swap(other.owned);
+        std::swap(first, other.first);
+        std::swap(count, other.count);
+        return *this;
+    }
+
+    // refers to 'size' elements at 'data' without taking ownership
+    static FlatArray borrow(const T * data, std::size_t size)
+    {
+        FlatArray array;
+        array.first = data;
+        array.count = size;
+        return array;
+    }
+
+    const T & operator[](std::size_t i) const
+    {
+        return first[i];
+    }
+
+    const T & at(std::size_t i) const
+    {
+        if (i >= count) {
+            throw std::out_of_range("FlatArray: index out of range");
+        }
+        return first[i];
+    }
+
+    const T * data() const
+    {
+        return first;
+    }
+
+    const T * begin() const
+    {
+        return first;
+    }
+
+    const T * end() const
+    {
+        return first + count;
+    }
+
+    std::size_t size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    // returns number of bytes occupied by the elements
+    std::size_t byte_size() const
+    {
+        return count * sizeof(T);
+    }
+
+private:
+    std::vector<T> owned;
+    const T * first = nullptr;
+    std::size_t count = 0;
+};
+
+// [begin, end) range of vertex indices
+struct VertexRange
+{
+    const unsigned * first = nullptr;
+    const unsigned * last = nullptr;
+
+    VertexRange() = default;
+
+    VertexRange(const unsigned * first, const unsigned * last)
+        : first(first)
+        , last(last)
+    {
+    }
+
+    VertexRange(const std::vector<unsigned> & verts)
+        : first(verts.data())
+        , last(verts.data() + verts.size())
+    {
+    }
+
+    const unsigned * begin() const
+    {
+        return first;
+    }
+
+    const unsigned * end() const
+    {
+        return last;
+    }
+
+    std::size_t size() const
+    {
+        return last - first;
+    }
+};
+
 class Digraph
 {
 public:
     Digraph() = default;
 
-    void reset_graph_size(std::size_t size);
+    static constexpr unsigned no_vert = static_cast<unsigned>(-1);
+
+    void reset_graph_size(std::size_t size);
+
+    // registers vertex with id 'v' (if it is new) and returns its index
+    unsigned add_vertex(unsigned v)
+    {
+        return get_or_add_vert(v);
+    }
+
+    void add_edge(unsigned v, unsigned w);
+
+    // packs adjacency lists and their reverse into contiguous arrays and indexes depths;
+    // no edges can be added afterwards.
+    // If ids are dense enough, id -> vert lookups switch from the hash map to a plain array
+    void freeze();
+
+    // returns index of vertex with id 'v' or 'no_vert'
+    unsigned find_vert(unsigned v) const
+    {
+        if (!id_vert_index.empty()) {
+            return v < id_vert_index.size() ? id_vert_index[v] : no_vert;
+        }
+        auto found_vertex = id_vert_map.find(v);
+        return found_vertex != id_vert_map.end() ? found_vertex->second : no_vert;
+    }
+
+    // returns index of vertex with id 'v', throws std::out_of_range if there is none
+    unsigned vert(unsigned v) const;
+
+    // returns id of vertex with index 'vert'
+    unsigned id(unsigned vert) const
+    {
+        return frozen() ? vert_ids[vert] : vert_id_map[vert];
+    }
+
+    std::vector<unsigned> get_neighbours(unsigned v) const;
+
+    // returns indices of vertices adjacent to vertex with index 'vert' without copying them,
+    // translate them with id() if ids are needed
+    VertexRange neighbours(unsigned vert) const
+    {
+        const auto [first, last] = adjacent(vert);
+        return {first, last};
+    }
+
+    // returns indices of vertices with an edge to vertex with index 'vert' (once frozen)
+    VertexRange reverse_neighbours(unsigned vert) const
+    {
+        const unsigned * sources = reverse_edge_targets.data();
+        return {sources + reverse_edge_offsets[vert], sources + reverse_edge_offsets[vert + 1]};
+    }
+
+    std::size_t size() const
+    {
+        return frozen() ? vert_ids.size() : vert_id_map.size();
+    }
+
+    void print(std::ostream & out) const;
+
+private:
+    friend class ShortestCommonAncestor;
+    friend class WordNet;
+
+    std::vector<std::vector<unsigned>> graph;           // vert -> vert, vert, ... (until frozen)
+    std::vector<unsigned> vert_id_map;                  // vert -> id (until frozen)
+    std::unordered_map<unsigned, unsigned> id_vert_map; // id -> vert (unless frozen with dense ids)
+    FlatArray<unsigned> edge_offsets;                   // vert -> first edge in 'edge_targets' (once frozen)
+    FlatArray<unsigned> edge_targets;                   // edges of all vertices, grouped by source vertex
+    FlatArray<unsigned> reverse_edge_offsets;           // vert -> first edge in 'reverse_edge_targets' (once frozen)
+    FlatArray<unsigned> reverse_edge_targets;           // sources of edges into every vertex, grouped by target
+    FlatArray<unsigned> vert_ids;                       // vert -> id (once frozen)
+    FlatArray<unsigned> id_vert_index;                  // id -> vert or 'no_vert' (once frozen with dense ids)
+    FlatArray<unsigned> depths;                         // vert -> distance to the nearest root
+    FlatArray<unsigned> up_depths;                      // vert -> max of depth(y) - distance to y over its ancestors y,
+                                                        // empty if edges form a cycle
+    unsigned max_depth = 0;                             // largest value of 'depths'
+
+    unsigned get_or_add_vert(unsigned v); // id -> vert
+
+    // returns unfrozen copy of this frozen graph, which keeps vertex indices and takes further vertices and edges
+    Digraph unfrozen_copy() const;
+
+    // computes 'depths' and 'up_depths' of a frozen graph
+    void index_depths();
+
+    bool frozen() const
+    {
+        return !edge_offsets.empty();
+    }
+
+    // returns [begin, end) range of vertices adjacent to 'vert'
+    std::pair<const unsigned *, const unsigned *> adjacent(unsigned vert) const
+    {
+        if (frozen()) {
+            const unsigned * targets = edge_targets.data();
+            return {targets + edge_offsets[vert], targets + edge_offsets[vert + 1]};
+        }
+        return {graph[vert].data(), graph[vert].data() + graph[vert].size()};
+    }
+};
+
+inline std::ostream & operator<<(std::ostream & out, const Digraph & d)
+{
+    d.print(out);
+    return out;
+}
+
+/**
+ * Scratch state of a graph search that is reused between queries.
+ *
+ * Every mark is tagged with the epoch of the search that set it, so starting
+ * a new search only bumps the epoch instead of clearing arrays sized to the
+ * whole graph: a query costs time proportional to the vertices it visits.
+ *
+ * The search runs from two sides at once; each side has its own marks,
+ * distances and queue.
+ *
+ * Batched searches use a second set of arrays instead: up to 64 independent
+ * searches run level by level together, each owning one bit of a per-vertex mask.
+ */
+class SearchWorkspace
+{
+public:
+    SearchWorkspace() = default;
+
+private:
+    friend class ShortestCommonAncestor;
+    friend class AncestorClosure;
+    friend class DigraphTraversal;
+    friend class WordNet;
+
+    struct Side
+    {
+        std::vector<unsigned> stamp;    // vert -> epoch of the search that marked it
+        std::vector<unsigned> distance; // vert -> distance from the side's subset
+        std::vector<unsigned> parent;   // vert -> vertex it was reached from by ShortestCommonAncestor
+        std::vector<unsigned> queue;    // every vertex is pushed at most once, so it never wraps
+        std::size_t queue_head = 0;
+        std::size_t queue_tail = 0;
+    };
+
+    // prepares workspace for a search over a graph with 'size' vertices
+    void start(std::size_t size);
+
+    bool is_marked(unsigned side, unsigned vert) const
+    {
+        return sides[side].stamp[vert] == epoch;
+    }
+
+    // records that 'side' reached 'vert' and queues it for expansion
+    void mark(unsigned side, unsigned vert, unsigned vert_distance)
+    {
+        sides[side].stamp[vert] = epoch;
+        sides[side].distance[vert] = vert_distance;
+        sides[side].queue[sides[side].queue_tail++] = vert;
+    }
+
+    Side sides[2];
+    unsigned epoch = 0;
+    std::vector<unsigned> path; // vertices of the last path found by WordNet::path()
+
+    // work done by searches since the counters were last reset, only counted in WORDNET_STATS builds
+    struct Counters
+    {
+        std::uint64_t vertices_visited = 0;
+        std::uint64_t edges_scanned = 0;
+        std::uint64_t queue_peak = 0;
+    };
+    Counters counters;
+
+    // bit lanes of a batched search, all masks are zero between searches
+    std::vector<std::uint64_t> lane_seen;          // vert -> lanes that have reached it
+    std::vector<std::uint64_t> lane_frontier;      // vert -> lanes that reached it in the current level
+    std::vector<std::uint64_t> lane_next_frontier; // vert -> lanes that reach it in the next level
+    std::vector<unsigned> lane_level;              // vertices with a non-zero frontier mask
+    std::vector<unsigned> lane_next_level;         // vertices with a non-zero next frontier mask
+    std::vector<unsigned> lane_touched;            // vertices with a non-zero seen mask
+
+    // prepares lane arrays for a batched search over a graph with 'size' vertices
+    void start_lanes(std::size_t size);
+};
+
+// edges followed by a traversal
+enum class EdgeDirection
+{
+    forward, // from a synset to its hypernyms
+    reverse, // from a synset to its hyponyms
+};
+
+// what a traversal does after a visitor has seen a vertex
+enum class VisitResult
+{
+    expand, // follow edges of the vertex
+    skip,   // do not follow edges of the vertex
+    stop,   // end the traversal
+};
+
+/**
+ * Traversals of a frozen Digraph along forward or reverse edges.
+ *
+ * Direction and visitors are template parameters, so visitor calls are inlined
+ * into the loops. A visitor returns VisitResult or nothing, which means
+ * VisitResult::expand. Marks, queue and stack live in 'workspace', so a
+ * traversal does not allocate once the workspace has grown to the graph; the
+ * workspace must not run other searches meanwhile.
+ */
+class DigraphTraversal
+{
+public:
+    // calls visit(vert, distance) once for every vertex reachable from 'sources', in order of distance
+    template <EdgeDirection direction, class Visit>
+    static void breadth_first(const Digraph & graph, VertexRange sources, SearchWorkspace & workspace, Visit && visit)
+    {
+        workspace.start(graph.size());
+        SearchWorkspace::Side & side = workspace.sides[0];
+        for (const unsigned vert : sources) {
+            if (!workspace.is_marked(0, vert)) {
+                workspace.mark(0, vert, 0);
+            }
+        }
+        while (side.queue_head != side.queue_tail) {
+            const unsigned vert = side.queue[side.queue_head++];
+            const VisitResult result = call(visit, vert, side.distance[vert]);
+            if (result == VisitResult::stop) {
+                return;
+            }
+            if (result == VisitResult::skip) {
+                continue;
+            }
+            for (const unsigned to : edges<direction>(graph, vert)) {
+                if (!workspace.is_marked(0, to)) {
+                    workspace.mark(0, to, side.distance[vert] + 1);
+                }
+            }
+        }
+    }
+
+    // walks depth first from every vertex of 'sources' in turn: enter(vert) is called when a vertex is
+    // discovered and finish(vert) once every vertex reachable from it is finished
+    template <EdgeDirection direction, class Enter, class Finish>
+    static void depth_first(const Digraph & graph, VertexRange sources, SearchWorkspace & workspace, Enter && enter, Finish && finish)
+    {
+        workspace.start(graph.size());
+        bool acyclic = true;
+        for (const unsigned vert : sources) {
+            if (!depth_first_from<direction>(graph, vert, workspace, enter, finish, acyclic)) {
+                return;
+            }
+        }
+    }
+
+    // calls visit(vert) for every vertex after all vertices its edges lead to; returns 'false' if edges form
+    // a cycle, then vertices on the cycle cannot be ordered and come in depth-first finishing order
+    template <EdgeDirection direction, class Visit>
+    static bool topological(const Digraph & graph, SearchWorkspace & workspace, Visit && visit)
+    {
+        workspace.start(graph.size());
+        bool acyclic = true;
+        const auto enter = [](unsigned) {
+        };
+        for (unsigned vert = 0; vert < graph.size(); ++vert) {
+            depth_first_from<direction>(graph, vert, workspace, enter, visit, acyclic);
+        }
+        return acyclic;
+    }
+
+private:
+    template <EdgeDirection direction>
+    static VertexRange edges(const Digraph & graph, unsigned vert)
+    {
+        if constexpr (direction == EdgeDirection::forward) {
+            return graph.neighbours(vert);
+        }
+        else {
+            return graph.reverse_neighbours(vert);
+        }
+    }
+
+    template <class Visitor, class... Args>
+    static VisitResult call(Visitor & visitor, Args... args)
+    {
+        if constexpr (std::is_void_v<std::invoke_result_t<Visitor &, Args...>>) {
+            visitor(args...);
+            return VisitResult::expand;
+        }
+        else {
+            return visitor(args...);
+        }
+    }
+
+    // depth-first walk from 'start' unless it is already discovered, returns 'false' if a visitor stopped it;
+    // the stack is the queue of side 0, the distance of an open vertex is the next of its edges to follow
+    // and side 1 marks finished vertices
+    template <EdgeDirection direction, class Enter, class Finish>
+    static bool depth_first_from(const Digraph & graph,
+                                 unsigned start,
+                                 SearchWorkspace & workspace,
+                                 Enter & enter,
+                                 Finish & finish,
+                                 bool & acyclic)
+    {
+        SearchWorkspace::Side & open = workspace.sides[0];
+        SearchWorkspace::Side & finished = workspace.sides[1];
+        const auto discover = [&](unsigned vert) {
+            workspace.mark(0, vert, 0);
+            const VisitResult result = call(enter, vert);
+            if (result == VisitResult::skip) {
+                open.distance[vert] = edges<direction>(graph, vert).size();
+            }
+            return result != VisitResult::stop;
+        };
+        if (workspace.is_marked(0, start)) {
+            return true;
+        }
+        const std::size_t bottom = open.queue_tail;
+        if (!discover(start)) {
+            return false;
+        }
+        while (open.queue_tail != bottom) {
+            const unsigned vert = open.queue[open.queue_tail - 1];
+            const VertexRange targets = edges<direction>(graph, vert);
+            if (open.distance[vert] == targets.size()) {
+                --open.queue_tail;
+                finished.stamp[vert] = workspace.epoch;
+                call(finish, vert);
+                continue;
+            }
+            const unsigned to = targets.begin()[open.distance[vert]++];
+            if (!workspace.is_marked(0, to)) {
+                if (!discover(to)) {
+                    return false;
+                }
+            }
+            else if (!workspace.is_marked(1, to)) {
+                acyclic = false;
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * Breadth-first walk over all ancestors of a vertex subset, the subset itself
+ * included. Every ancestor is yielded once, in order of distance, and is only
+ * discovered when the walk gets to it. The walk keeps its queue and marks in the
+ * first side of 'workspace', so it does not allocate once the workspace has
+ * grown to the graph; the workspace must not run other searches meanwhile.
+ */
+class AncestorClosure
+{
+public:
+    struct Ancestor
+    {
+        unsigned vert;
+        unsigned distance; // from the nearest vertex of the subset
+    };
+
+    class iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Ancestor;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Ancestor *;
+        using reference = Ancestor;
+
+        iterator() = default;
+
+        Ancestor operator*() const
+        {
+            return closure->at(pos);
+        }
+
+        iterator & operator++()
+        {
+            ++pos;
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator old = *this;
+            ++pos;
+            return old;
+        }
+
+        bool operator==(const iterator & rhs) const
+        {
+            const bool done = is_done();
+            return done == rhs.is_done() && (done || pos == rhs.pos);
+        }
+
+        bool operator!=(const iterator & rhs) const
+        {
+            return !(*this == rhs);
+        }
+
+    private:
+        friend class AncestorClosure;
+
+        AncestorClosure * closure = nullptr;
+        std::size_t pos = 0;
+
+        iterator(AncestorClosure * closure, std::size_t pos)
+            : closure(closure)
+            , pos(pos)
+        {
+        }
+
+        bool is_done() const
+        {
+            return closure == nullptr || !closure->reach(pos);
+        }
+    };
+
+    AncestorClosure(const Digraph & graph, VertexRange subset, SearchWorkspace & workspace);
+
+    iterator begin()
+    {
+        return {this, 0};
+    }
+
+    iterator end()
+    {
+        return {};
+    }
+
+private:
+    const Digraph & graph;
+    SearchWorkspace & workspace;
+
+    // expands the walk until it has found at least 'pos' + 1 ancestors, returns 'false' if there are fewer
+    bool reach(std::size_t pos);
+
+    Ancestor at(std::size_t pos) const
+    {
+        const SearchWorkspace::Side & side = workspace.sides[0];
+        return {side.queue[pos], side.distance[side.queue[pos]]};
+    }
+};
+
+/**
+ * Optional index of ancestor-distance labels.
+ *
+ * For every vertex it stores all of its ancestors (the vertex itself included)
+ * together with their distances, sorted by ancestor and packed in one flat
+ * arena. A shortest common ancestor query then becomes a merge of two labels
+ * instead of a graph traversal.
+ */
+class AncestorLabels
+{
+public:
+    struct Entry
+    {
+        unsigned ancestor;
+        unsigned distance;
+    };
+
+    AncestorLabels() = default;
+
+    // computes labels of all vertices of frozen graph 'graph'
+    void build(const Digraph & graph, SearchWorkspace & workspace);
+
+    // computes labels of frozen graph 'graph', which extends the graph labelled by 'previous' with vertices and
+    // edges: labels of vertices marked in 'stale' are recomputed and all others are copied from 'previous'
+    void update(const AncestorLabels & previous,
+                const Digraph & graph,
+                const std::vector<char> & stale,
+                SearchWorkspace & workspace);
+
+    bool empty() const
+    {
+        return offsets.empty();
+    }
+
+    // returns number of bytes occupied by the index
+    std::size_t memory_usage() const
+    {
+        return offsets.byte_size() + entries.byte_size();
+    }
+
+private:
+    friend class ShortestCommonAncestor;
+    friend class WordNet;
+
+    FlatArray<unsigned> offsets; // vert -> first entry of its label in 'entries'
+    FlatArray<Entry> entries;    // labels of all vertices
+
+    // returns [begin, end) range of label of 'vert'
+    std::pair<const Entry *, const Entry *> label(unsigned vert) const
+    {
+        return {entries.data() + offsets[vert], entries.data() + offsets[vert + 1]};
+    }
+};
+
+// how ShortestCommonAncestor explores the graph
+enum class SearchMode
+{
+    exhaustive,    // visits every ancestor of both subsets
+    bidirectional, // expands the two frontiers level by level and stops once no shorter path is possible
+};
+
+class ShortestCommonAncestor
+{
+    friend class AncestorLabels;
+    friend class WordNet;
+
+    const Digraph & graph;
+    SearchWorkspace & workspace;
+    SearchMode mode;
+    const AncestorLabels * labels; // answers queries without traversal if present
+
+    ShortestCommonAncestor(const Digraph & dg,
+                           SearchWorkspace & ws,
+                           SearchMode mode = SearchMode::bidirectional,
+                           const AncestorLabels * labels = nullptr)
+        : graph(dg)
+        , workspace(ws)
+        , mode(mode)
+        , labels(labels)
+    {
+    }
+
+    // returns shortest common ancestor vertex of vertex subsets 'subset_a' and 'subset_b' and length of the path
+    std::pair<unsigned, unsigned> ancestor_length(VertexRange subset_a, VertexRange subset_b) const;
+
+    // ancestor_length of two single vertices, searched without any loop over subsets
+    std::pair<unsigned, unsigned> ancestor_length(unsigned vert_a, unsigned vert_b) const;
+
+    template <std::size_t N, std::size_t M>
+    std::pair<unsigned, unsigned> ancestor_length(const std::array<unsigned, N> & subset_a,
+                                                  const std::array<unsigned, M> & subset_b) const
+    {
+        if constexpr (N == 1 && M == 1) {
+            return ancestor_length(subset_a[0], subset_b[0]);
+        }
+        else {
+            return ancestor_length(VertexRange(subset_a.data(), subset_a.data() + N),
+                                   VertexRange(subset_b.data(), subset_b.data() + M));
+        }
+    }
+
+    // finds a shortest ancestral path of 'subset_a' and 'subset_b' by traversal, even if labels are present,
+    // and stores its vertices in 'path': from a vertex of 'subset_a' up to the ancestor and down to a vertex
+    // of 'subset_b'; returns the same ancestor and length as a traversal by ancestor_length
+    std::pair<unsigned, unsigned> ancestor_path(VertexRange subset_a, VertexRange subset_b, std::vector<unsigned> & path) const;
+
+    // stores in 'path' a shortest ancestral path through 'ancestor', a shortest common ancestor found without
+    // parents (by labels or earlier), climbing from both subsets until they reach it
+    void ancestor_path(VertexRange subset_a, VertexRange subset_b, unsigned ancestor, std::vector<unsigned> & path) const;
+
+    // stores in 'path' the vertices leading from the ancestor back to both subsets along parent pointers
+    void trace_path(unsigned ancestor, unsigned length, std::vector<unsigned> & path) const;
+
+    // two-sided search behind ancestor_length, instantiated for vertex ranges and single vertices
+    template <class SubsetA, class SubsetB>
+    std::pair<unsigned, unsigned> search(const SubsetA & subset_a, const SubsetB & subset_b) const;
+
+    using AncestorRange = std::pair<const AncestorLabels::Entry *, const AncestorLabels::Entry *>;
+
+    // appends all ancestors of vertex subset 'subset' with their distances to 'out', sorted by ancestor
+    void ancestor_map(VertexRange subset, std::vector<AncestorLabels::Entry> & out) const;
+
+    // appends ancestor maps of 'count' subsets to 'out', 64 subsets per traversal;
+    // map i is [offsets[i], offsets[i + 1]) of 'out'
+    void ancestor_maps(const VertexRange * subsets,
+                       std::size_t count,
+                       std::vector<AncestorLabels::Entry> & out,
+                       std::vector<std::size_t> & offsets) const;
+
+    // updates best meeting vertex with common ancestors of two ancestor maps sorted by ancestor
+    static void merge_ancestor_maps(AncestorRange a, AncestorRange b, unsigned & min_distance, unsigned & min_distance_ancestor);
+
+    // answers ancestor_length by merging precomputed labels
+    std::pair<unsigned, unsigned> ancestor_length_by_labels(VertexRange subset_a, VertexRange subset_b) const;
+
+    // marks unvisited vertices of the next level of 'side', updating the best meeting vertex found so far;
+    // 'other_depth' is the smallest depth of the other side's subset
+    void expand_level(unsigned side, unsigned other_depth, unsigned & min_distance, unsigned & min_distance_ancestor) const;
+
+    // vertex indices of a subset of node ids, stored inline unless the subset is large
+    class SubsetVerts
+    {
+    public:
+        SubsetVerts(const Digraph & graph, const std::set<unsigned> & ids)
+            : count(ids.size())
+        {
+            unsigned * out = inline_verts;
+            if (count > inline_capacity) {
+                heap_verts.resize(count);
+                out = heap_verts.data();
+            }
+            for (const unsigned id : ids) {
+                *out++ = graph.vert(id);
+            }
+        }
+
+        SubsetVerts(const SubsetVerts &) = delete;
+        SubsetVerts & operator=(const SubsetVerts &) = delete;
+
+        operator VertexRange() const
+        {
+            const unsigned * verts = count > inline_capacity ? heap_verts.data() : inline_verts;
+            return {verts, verts + count};
+        }
+
+    private:
+        static constexpr std::size_t inline_capacity = 8;
+
+        std::size_t count;
+        unsigned inline_verts[inline_capacity];
+        std::vector<unsigned> heap_verts;
+    };
+
+    // calculates length of shortest common ancestor path from node with id 'v' to node with id 'w'
+    unsigned length(unsigned v, unsigned w)
+    {
+        return ancestor_length(graph.vert(v), graph.vert(w)).second;
+    }
+
+    // returns node id of shortest common ancestor of nodes v and w
+    unsigned ancestor(unsigned v, unsigned w)
+    {
+        return graph.id(ancestor_length(graph.vert(v), graph.vert(w)).first);
+    }
+
+    // calculates length of shortest common ancestor path from node subset 'subset_a' to node subset 'subset_b'
+    unsigned length_subset(const std::set<unsigned> & subset_a, const std::set<unsigned> & subset_b)
+    {
+        return ancestor_length(SubsetVerts(graph, subset_a), SubsetVerts(graph, subset_b)).second;
+    }
+
+    // returns node id of shortest common ancestor of node subset 'subset_a' and node subset 'subset_b'
+    unsigned ancestor_subset(const std::set<unsigned> & subset_a, const std::set<unsigned> & subset_b)
+    {
+        return graph.id(ancestor_length(SubsetVerts(graph, subset_a), SubsetVerts(graph, subset_b)).first);
+    }
+};
+
+struct WordNetOptions
+{
+    SearchMode search_mode = SearchMode::bidirectional;
+    // precompute ancestor labels in the constructor, see WordNet::label_index_memory()
+    bool build_label_index = false;
+    // number of threads parsing the input (0 means one per hardware thread)
+    unsigned load_threads = 1;
+    // keep only nouns resident after loading from files: nouns are copied to a compact buffer and
+    // pages of the mapped synsets file are released, so a gloss is read from the file when requested
+    bool lazy_glosses = false;
+    // number of noun pairs whose query results are cached, split evenly between shards
+    // (0 disables the cache), see WordNet::cache_stats()
+    std::size_t cache_capacity = 0;
+    // number of independently locked parts of the cache, at most one per cached pair
+    unsigned cache_shards = 16;
+};
+
+/**
+ * Bounded cache of query results keyed by an unordered pair of noun indices.
+ * Pairs are spread over independently locked shards, each of which evicts its
+ * least recently used pair when full, so concurrent readers rarely contend.
+ */
+class ResultCache
+{
+public:
+    struct Stats
+    {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::size_t size = 0; // number of cached pairs
+    };
+
+    ResultCache(std::size_t capacity, unsigned shards);
+    ~ResultCache();
+
+    // stores result cached for pair (noun1, noun2) to 'result', returns 'false' if it is not cached
+    bool find(unsigned noun1, unsigned noun2, std::pair<unsigned, unsigned> & result);
 
-    void add_edge(unsigned v, unsigned w);
+    void insert(unsigned noun1, unsigned noun2, std::pair<unsigned, unsigned> result);
 
-    std::vector<unsigned> get_neighbours(unsigned v) const;
+    Stats stats() const;
 
-    std::size_t size() const
+    void clear();
+
+    // cached result of a pair of nouns
+    struct Item
     {
-        return graph.size();
-    }
+        unsigned noun1;
+        unsigned noun2;
+        std::pair<unsigned, unsigned> result;
+    };
 
-    void print(std::ostream & out) const;
+    // returns all cached pairs, least recently used first within every shard
+    std::vector<Item> items() const;
+
+    // returns an empty cache with the capacity and number of shards of this one
+    std::unique_ptr<ResultCache> clone_empty() const;
 
 private:
-    friend class ShortestCommonAncestor;
+    struct Shard;
 
-    std::vector<std::vector<unsigned>> graph;           // vert -> vert, vert, ...
-    std::unordered_map<unsigned, unsigned> id_vert_map; // id -> vert
-    std::vector<unsigned> vert_id_map;                  // vert -> id
+    std::unique_ptr<Shard[]> shards;
+    std::size_t capacity; // pairs held by all shards together
+    unsigned shard_count;
 
-    unsigned get_or_add_vert(unsigned v); // id -> vert
+    static std::uint64_t key(unsigned noun1, unsigned noun2);
+
+    Shard & shard_of(std::uint64_t key) const;
 };
 
-inline std::ostream & operator<<(std::ostream & out, const Digraph & d)
+/**
+ * Snapshot of query counters of a WordNet, see WordNet::stats().
+ *
+ * Counters are only collected when the library is built with WORDNET_STATS
+ * defined; otherwise the counting code is compiled out and all values stay zero.
+ */
+struct WordNetStats
 {
-    d.print(out);
-    return out;
-}
+    enum Api
+    {
+        distance_api,   // distance(), distances()
+        sca_api,        // sca(), sca_view(), sca_id(), sca_distance()
+        similarity_api, // similarity()
+        nearest_api,    // nearest()
+        path_api,       // path()
+        api_count
+    };
 
-class ShortestCommonAncestor
+    // bucket i counts calls that took [2^i, 2^(i + 1)) nanoseconds, bucket 0 also counts faster ones
+    static constexpr std::size_t latency_buckets = 32;
+
+    struct Latency
+    {
+        std::uint64_t calls = 0;
+        std::uint64_t histogram[latency_buckets] = {};
+    };
+
+    bool enabled = false;               // 'true' in WORDNET_STATS builds
+    std::uint64_t searches = 0;         // graph traversals, cache hits are not counted
+    std::uint64_t vertices_visited = 0; // vertices expanded by all searches
+    std::uint64_t edges_scanned = 0;    // edges followed by all searches
+    std::uint64_t queue_peak = 0;       // most vertices queued by one search
+    std::uint64_t lookup_failures = 0;  // lookups of nouns that are not stored
+    Latency latency[api_count];         // per API, measured after the nouns are looked up
+};
+
+/**
+ * Read-only bytes of an input file, either memory-mapped or copied to one heap block.
+ * Moving a buffer keeps the bytes in place, so views into them stay valid.
+ */
+class SourceBuffer
 {
-    friend class WordNet;
+public:
+    SourceBuffer() = default;
+    SourceBuffer(SourceBuffer && other) noexcept;
+    SourceBuffer & operator=(SourceBuffer && other) noexcept;
+    ~SourceBuffer();
 
-    const Digraph & graph;
+    // maps file 'path' into memory, throws std::system_error on failure
+    static SourceBuffer map_file(const std::string & path);
 
-    explicit ShortestCommonAncestor(const Digraph & dg)
-        : graph(dg)
-    {
-    }
+    // maps POSIX shared memory object 'name' into memory, throws std::system_error on failure
+    static SourceBuffer map_shared_memory(const std::string & name);
 
-    std::pair<unsigned, unsigned> ancestor_length(const std::vector<unsigned> & subset_a,
-                                                  const std::vector<unsigned> & subset_b) const;
+    // reads the rest of stream 'in' into memory
+    static SourceBuffer read_stream(std::istream & in);
 
-    // calculates length of shortest common ancestor path from node with id 'v' to node with id 'w'
-    unsigned length(unsigned v, unsigned w)
+    std::string_view view() const
     {
-        return ancestor_length({v}, {w}).second;
+        return {data, size};
     }
 
-    // returns node id of shortest common ancestor of nodes v and w
-    unsigned ancestor(unsigned v, unsigned w)
+    bool is_mapped() const
     {
-        return ancestor_length({v}, {w}).first;
+        return mapped;
     }
 
-    // calculates length of shortest common ancestor path from node subset 'subset_a' to node subset 'subset_b'
-    unsigned length_subset(const std::set<unsigned> & subset_a, const std::set<unsigned> & subset_b)
-    {
-        return ancestor_length({subset_a.begin(), subset_a.end()},
-                               {subset_b.begin(), subset_b.end()})
-                .second;
-    }
+    // lets the system drop resident pages of a mapped file, they are read again from the file when touched
+    void discard_pages() const;
 
-    // returns node id of shortest common ancestor of node subset 'subset_a' and node subset 'subset_b'
-    unsigned ancestor_subset(const std::set<unsigned> & subset_a, const std::set<unsigned> & subset_b)
+private:
+    const char * data = nullptr;
+    std::size_t size = 0;
+    bool mapped = false;
+    std::unique_ptr<char[]> heap;
+
+    void release();
+
+    // maps file descriptor 'fd' of 'path' and closes it
+    static SourceBuffer map_descriptor(int fd, const std::string & path);
+};
+
+/**
+ * Additions to a WordNet, see WordNet::with_delta().
+ */
+struct WordNetDelta
+{
+    struct Synset
     {
-        return ancestor_length({subset_a.begin(), subset_a.end()},
-                               {subset_b.begin(), subset_b.end()})
-                .first;
-    }
+        unsigned id;
+        std::vector<std::string> nouns;
+        std::string gloss;
+    };
+
+    std::vector<Synset> synsets;                          // new synsets
+    std::vector<std::pair<std::string, unsigned>> nouns;  // noun added to an existing or new synset with given id
+    std::vector<std::pair<unsigned, unsigned>> hypernyms; // new edge from synset id to hypernym synset id
 };
 
+/**
+ * WordNet is immutable once constructed: all const member functions may be
+ * called concurrently from any number of threads on one shared instance.
+ * Search scratch state lives in per-thread workspaces, never in the instance.
+ */
 class WordNet
 {
-    using storage_type = std::unordered_map<std::string_view, std::vector<unsigned>>;
+    // [offset, offset + length) range of WordNet text
+    struct TextRef
+    {
+        unsigned offset;
+        unsigned length;
+    };
 
 public:
-    WordNet(std::istream & synsets, std::istream & hypernyms);
+    WordNet(std::istream & synsets, std::istream & hypernyms, const WordNetOptions & options = {});
+    WordNet(WordNet && other) noexcept;
+    WordNet & operator=(WordNet && other) noexcept;
+    ~WordNet();
+
+    // loads WordNet from files: synsets file is memory-mapped and nouns and glosses refer directly to it
+    static WordNet from_files(const std::string & synsets_path,
+                              const std::string & hypernyms_path,
+                              const WordNetOptions & options = {});
+
+    /**
+     * Opens a snapshot written by save_snapshot().
+     *
+     * The file is memory-mapped and queried in place: nouns, glosses, graph and
+     * label index (if it was saved) are used without any per-element decoding,
+     * and processes opening the same snapshot share one page-cache copy.
+     * Throws std::runtime_error if the file is not a compatible snapshot.
+     */
+    static WordNet open_snapshot(const std::string & path, const WordNetOptions & options = {});
+
+    // writes binary snapshot of this WordNet to 'path'
+    void save_snapshot(const std::string & path) const;
+
+    /**
+     * Writes the snapshot image of this WordNet to POSIX shared memory object
+     * 'name' (e.g. "/wordnet"), replacing an existing one; processes attached
+     * to the replaced object keep using it until they detach.
+     *
+     * The header is written last, so attaching to an object that is still
+     * being written fails as if it were not a snapshot.
+     * Throws std::system_error on failure.
+     */
+    void publish_shared(const std::string & name) const;
+
+    /**
+     * Attaches to a WordNet published with publish_shared(), see open_snapshot().
+     * All attached processes query one copy of the image in shared memory.
+     */
+    static WordNet attach_shared(const std::string & name, const WordNetOptions & options = {});
+
+    // removes shared memory object 'name', attached processes keep their mapping
+    static void unpublish_shared(const std::string & name);
+
+    /**
+     * Returns a new WordNet with 'delta' applied, leaving this one untouched so
+     * that queries running on it are unaffected; see LiveWordNet for publishing
+     * versions to concurrent readers.
+     *
+     * Nothing is parsed again: synset and noun tables are extended, and only
+     * labels of synsets whose ancestors change are recomputed. Cached results
+     * of noun pairs whose synsets keep their ancestors are carried over.
+     * The new WordNet keeps its text in memory, including glosses that are
+     * lazy in this one. Throws std::invalid_argument if a new synset id is
+     * already taken and std::out_of_range if the delta refers to an unknown one.
+     */
+    WordNet with_delta(const WordNetDelta & delta) const;
 
     /**
      * Simple proxy class used to enumerate nouns.
@@ -98,7 +1042,7 @@ public:
      *
      * WordNet wordnet{...};
      * ...
-     * for (const std::string & noun : wordnet.nouns()) {
+     * for (const std::string_view noun : wordnet.nouns()) {
      *     // ...
      * }
      */
@@ -106,10 +1050,14 @@ public:
     {
         friend class WordNet;
 
-        const storage_type & storage;
+        const WordNet & wordnet;
+        const TextRef * first;
+        const TextRef * last;
 
-        Nouns(const storage_type & storage)
-            : storage(storage)
+        Nouns(const WordNet & wordnet, const TextRef * first, const TextRef * last)
+            : wordnet(wordnet)
+            , first(first)
+            , last(last)
         {
         }
 
@@ -120,14 +1068,33 @@ public:
             using difference_type = std::ptrdiff_t;
             using iterator_category = std::forward_iterator_tag;
             using value_type = std::string_view;
-            using pointer = const value_type *;
-            using reference = const value_type &;
+            using reference = value_type; // nouns are views of the text, made on every dereference
+
+            // keeps the view that operator-> points into alive for the duration of the member access
+            class pointer
+            {
+            public:
+                const value_type * operator->() const
+                {
+                    return &value;
+                }
+
+            private:
+                friend class iterator;
+
+                explicit pointer(value_type value)
+                    : value(value)
+                {
+                }
+
+                value_type value;
+            };
 
             iterator() = default;
 
             bool operator==(const iterator & rhs) const
             {
-                return it == rhs.it;
+                return name == rhs.name;
             }
 
             bool operator!=(const iterator & rhs) const
@@ -137,17 +1104,17 @@ public:
 
             reference operator*() const
             {
-                return (*it).first;
+                return text.substr(name->offset, name->length);
             }
 
             pointer operator->() const
             {
-                return &it->first;
+                return pointer(operator*());
             }
 
             iterator & operator++()
             {
-                ++it;
+                ++name;
                 return *this;
             }
 
@@ -161,62 +1128,429 @@ public:
         private:
             friend class Nouns;
 
-            using wrapped_iterator = storage_type::const_iterator;
-
-            iterator(wrapped_iterator it)
-                : it(it)
+            iterator(const TextRef * name, std::string_view text)
+                : name(name)
+                , text(text)
             {
             }
 
-            wrapped_iterator it;
+            const TextRef * name = nullptr;
+            std::string_view text;
         };
 
         iterator begin() const
         {
-            return iterator(storage.begin());
+            return iterator(first, wordnet.text);
         }
         iterator end() const
         {
-            return iterator(storage.end());
+            return iterator(last, wordnet.text);
         }
     };
 
     // lists all nouns stored in WordNet
     Nouns nouns() const
     {
-        return Nouns(word_ids);
+        return Nouns(*this, noun_names.begin(), noun_names.end());
+    }
+
+    // lists nouns starting with 'prefix' in sorted order, found without scanning the other nouns
+    Nouns nouns_with_prefix(std::string_view prefix) const;
+
+    /**
+     * Handle of a noun, resolved once with noun_id() and then passed to
+     * repeated queries instead of the noun itself, which skips the lookup.
+     * A handle is only meaningful for the WordNet that produced it.
+     */
+    class NounId
+    {
+    public:
+        NounId() = default;
+
+        // returns 'false' for handles of nouns that are not stored in WordNet
+        bool valid() const
+        {
+            return index != invalid_index;
+        }
+
+        bool operator==(const NounId & rhs) const
+        {
+            return index == rhs.index;
+        }
+
+        bool operator!=(const NounId & rhs) const
+        {
+            return !(*this == rhs);
+        }
+
+    private:
+        friend class WordNet;
+
+        static constexpr unsigned invalid_index = static_cast<unsigned>(-1);
+
+        explicit NounId(unsigned index)
+            : index(index)
+        {
+        }
+
+        unsigned index = invalid_index;
+    };
+
+    // returns handle of 'noun' (invalid if it is not stored in WordNet)
+    NounId noun_id(std::string_view noun) const;
+
+    // returns noun of handle 'id'
+    std::string_view noun(NounId id) const
+    {
+        return text_of(noun_names.at(id.index));
+    }
+
+    /**
+     * Returns the hypernym graph, loaded or mapped from a snapshot, for
+     * traversals of one's own with DigraphTraversal or AncestorClosure.
+     * Its vertices are synsets: noun_synsets() maps a noun to them and
+     * Digraph::id() maps a vertex back to its synset id.
+     */
+    const Digraph & digraph() const
+    {
+        return graph;
+    }
+
+    // returns vertices of digraph() that are synsets of noun 'id', throws std::out_of_range for an invalid handle
+    VertexRange noun_synsets(NounId id) const
+    {
+        if (id.index >= noun_names.size()) {
+            throw std::out_of_range("WordNet: invalid noun handle");
+        }
+        return {noun_verts.data() + noun_vert_offsets[id.index], noun_verts.data() + noun_vert_offsets[id.index + 1]};
+    }
+
+    // returns vertices of digraph() that are synsets of 'noun', throws std::out_of_range if it is not stored
+    VertexRange noun_synsets(std::string_view noun) const
+    {
+        return noun_synsets(resolve_noun(noun));
+    }
+
+    // returns distance from the closest synset of 'noun' to the nearest root
+    unsigned depth(std::string_view noun) const
+    {
+        return depth(resolve_noun(noun));
     }
 
+    unsigned depth(NounId noun) const;
+
     // returns 'true' if 'word' is stored in WordNet
-    bool is_noun(const std::string & word) const
+    bool is_noun(std::string_view word) const
     {
-        return word_ids.find(word) != word_ids.end();
+        return noun_id(word).valid();
     }
 
+    /**
+     * Returns handles of nouns matching 'word' up to ASCII case, with spaces
+     * and underscores treated alike; an exact match comes first. If nothing
+     * matches, 'word' is tried without a plural ending: "ies" -> "y", "es"
+     * and "s". Returns no handles if there is still no match.
+     */
+    std::vector<NounId> match_nouns(std::string_view word) const;
+
     // returns gloss of "shortest common ancestor" of noun1 and noun2
-    std::string sca(const std::string & noun1, const std::string & noun2) const
+    std::string sca(std::string_view noun1, std::string_view noun2) const
+    {
+        return std::string(sca_view(noun1, noun2));
+    }
+
+    std::string sca(NounId noun1, NounId noun2) const
+    {
+        return std::string(sca_view(noun1, noun2));
+    }
+
+    // returns gloss of "shortest common ancestor" of noun1 and noun2 without copying it,
+    // the view stays valid as long as WordNet does
+    std::string_view sca_view(std::string_view noun1, std::string_view noun2) const
     {
-        return std::string(glosses.at(find_sca_distance(noun1, noun2).first));
+        return find_sca(noun1, noun2, WordNetStats::sca_api).gloss;
     }
 
+    std::string_view sca_view(NounId noun1, NounId noun2) const
+    {
+        return find_sca(noun1, noun2, WordNetStats::sca_api).gloss;
+    }
+
+    // returns synset id of "shortest common ancestor" of noun1 and noun2
+    unsigned sca_id(std::string_view noun1, std::string_view noun2) const
+    {
+        return find_sca(noun1, noun2, WordNetStats::sca_api).synset;
+    }
+
+    unsigned sca_id(NounId noun1, NounId noun2) const
+    {
+        return find_sca(noun1, noun2, WordNetStats::sca_api).synset;
+    }
+
+    // "shortest common ancestor" of two nouns together with distance between them
+    struct SCAResult
+    {
+        std::string_view gloss; // valid as long as WordNet is
+        unsigned synset;        // synset id
+        unsigned distance;
+    };
+
+    // returns ancestor and distance of noun1 and noun2 found by one search,
+    // cheaper than calling sca() and distance() for the same pair
+    SCAResult sca_distance(std::string_view noun1, std::string_view noun2) const
+    {
+        return find_sca(noun1, noun2, WordNetStats::sca_api);
+    }
+
+    SCAResult sca_distance(NounId noun1, NounId noun2) const
+    {
+        return find_sca(noun1, noun2, WordNetStats::sca_api);
+    }
+
+    // similarity scores of two nouns, all derived from their shortest common ancestor
+    struct Similarity
+    {
+        double path;             // 1 / (distance + 1)
+        double wu_palmer;        // 2 * depth(sca) / (distance + 2 * depth(sca)), depths counted in synsets
+        double leacock_chodorow; // -log((distance + 1) / (2 * taxonomy depth)), taxonomy depth counted in synsets
+    };
+
+    // returns all similarity scores of noun1 and noun2 computed from one search
+    Similarity similarity(std::string_view noun1, std::string_view noun2) const
+    {
+        return similarity(resolve_noun(noun1), resolve_noun(noun2));
+    }
+
+    Similarity similarity(NounId noun1, NounId noun2) const;
+
     // calculates distance between noun1 and noun2
-    unsigned distance(const std::string & noun1, const std::string & noun2) const
+    unsigned distance(std::string_view noun1, std::string_view noun2) const
+    {
+        return find_sca(noun1, noun2, WordNetStats::distance_api).distance;
+    }
+
+    unsigned distance(NounId noun1, NounId noun2) const
+    {
+        return find_sca(noun1, noun2, WordNetStats::distance_api).distance;
+    }
+
+    struct NearNoun
+    {
+        std::string_view noun; // valid as long as WordNet is
+        unsigned distance;
+    };
+
+    // returns up to 'k' nouns closest to 'noun' (which is not included) in order of increasing distance;
+    // nouns at equal distance come in the order the search meets them
+    std::vector<NearNoun> nearest(std::string_view noun, std::size_t k) const
+    {
+        return nearest(resolve_noun(noun), k);
+    }
+
+    std::vector<NearNoun> nearest(NounId noun, std::size_t k) const;
+
+    // synset on a path between two nouns
+    struct PathStep
+    {
+        unsigned synset;        // synset id
+        std::string_view gloss; // valid as long as WordNet is
+    };
+
+    // fills 'out' with a shortest ancestral path of noun1 and noun2: synsets from one of noun1 up to the
+    // ancestor sca_id(noun1, noun2) reports and down to one of noun2, distance(noun1, noun2) + 1 of them;
+    // 'out' is cleared first and grows only while it is smaller than the path, so a reused buffer stops
+    // allocating
+    void path(std::string_view noun1, std::string_view noun2, std::vector<PathStep> & out) const
+    {
+        path(resolve_noun(noun1), resolve_noun(noun2), out);
+    }
+
+    void path(NounId noun1, NounId noun2, std::vector<PathStep> & out) const;
+
+    // calculates distances for a batch of noun pairs, spreading the work over 'threads' threads
+    // (0 means one per hardware thread); result[i] is distance between pairs[i].first and pairs[i].second
+    std::vector<unsigned> distances(const std::vector<std::pair<std::string_view, std::string_view>> & pairs,
+                                    unsigned threads = 0) const;
+
+    // calculates distances between all pairs of 'nouns': result[i][j] is distance between nouns[i] and nouns[j]
+    std::vector<std::vector<unsigned>> distance_matrix(const std::vector<std::string_view> & nouns) const;
+
+    // returns number of bytes occupied by the ancestor label index (0 if it was not built)
+    std::size_t label_index_memory() const
+    {
+        return labels.memory_usage();
+    }
+
+    // returns hit and miss counters of the result cache (all zero if it is disabled)
+    ResultCache::Stats cache_stats() const
     {
-        return find_sca_distance(noun1, noun2).second;
+        return cache ? cache->stats() : ResultCache::Stats{};
     }
 
+    // returns query counters collected so far (all zero unless built with WORDNET_STATS)
+    WordNetStats stats() const;
+
 private:
-    std::vector<std::string> source_lines;
-    storage_type word_ids;
-    std::unordered_map<unsigned, std::string_view> glosses;
+    SourceBuffer source;                   // synsets file or snapshot image
+    std::string_view text;                 // nouns are ranges of it
+    std::string_view gloss_text;           // glosses are ranges of it, same as 'text' unless glosses are lazy
+    std::vector<char> compact_nouns;       // owns 'text' when glosses are lazy or after with_delta()
+    std::vector<char> owned_glosses;       // owns 'gloss_text' of a lazy WordNet after with_delta()
+    FlatArray<TextRef> noun_names;         // all nouns, sorted
+    FlatArray<unsigned> noun_vert_offsets; // noun -> first vertex in 'noun_verts'
+    FlatArray<unsigned> noun_verts;        // synset vertices of all nouns, grouped by noun
+    FlatArray<unsigned> vert_noun_offsets; // vert -> first noun in 'vert_nouns'
+    FlatArray<unsigned> vert_nouns;        // nouns of all synsets, grouped by vertex
+    FlatArray<unsigned> folded_nouns;      // all nouns, sorted by case-folded form, see match_nouns()
+    FlatArray<TextRef> glosses;            // vert -> gloss
     Digraph graph;
+    SearchMode search_mode;
+    AncestorLabels labels;
+    std::unique_ptr<ResultCache> cache;    // null if disabled
+    struct StatsCounters;
+    class ApiTimer;
+    std::unique_ptr<StatsCounters> counters; // null unless built with WORDNET_STATS
+
+    explicit WordNet(const WordNetOptions & options);
+
+    WordNet(SourceBuffer synsets, const SourceBuffer & hypernyms, const WordNetOptions & options);
+
+    std::string_view text_of(TextRef ref) const
+    {
+        return text.substr(ref.offset, ref.length);
+    }
+
+    std::string_view gloss_of(unsigned vert) const
+    {
+        const TextRef ref = glosses.at(vert);
+        return gloss_text.substr(ref.offset, ref.length);
+    }
+
+    // moves nouns to 'compact_nouns' and releases the pages of the synsets file
+    void make_glosses_lazy();
+
+    // builds the vertex -> nouns tables from the noun -> vertices tables
+    void index_vert_nouns();
+
+    // sorts nouns into 'folded_nouns'
+    void index_folded_nouns();
+
+    // appends handles of nouns with the folded form of 'word' that are not in 'out' yet
+    void append_folded_matches(std::string_view word, std::vector<NounId> & out) const;
+
+    // returns handle of 'noun', throws std::out_of_range if it is not stored
+    NounId resolve_noun(std::string_view noun) const
+    {
+        NounId id = noun_id(noun);
+        if (!id.valid()) {
+            throw std::out_of_range("WordNet: unknown noun " + std::string(noun));
+        }
+        return id;
+    }
+
+
+    // queries snapshot image 'image' in place, 'origin' names it in errors
+    static WordNet open_snapshot_image(SourceBuffer image, const std::string & origin, const WordNetOptions & options);
+
+    // writes snapshot image to file descriptor 'fd' of 'path', the header after all sections
+    void write_snapshot(int fd, const std::string & path) const;
+
+    // parses synsets from 'text' and hypernyms from 'hypernyms_text' using 'threads' threads
+    void load(std::string_view hypernyms_text, unsigned threads);
+
+    // search scratch state of the calling thread, shared by all WordNet instances
+    static SearchWorkspace & local_workspace();
+
+    ShortestCommonAncestor make_sca(SearchWorkspace & workspace) const
+    {
+        return ShortestCommonAncestor(graph, workspace, search_mode, labels.empty() ? nullptr : &labels);
+    }
+
+    friend class Outcast;
+    friend class OutcastSet;
+
+    using AncestorRange = ShortestCommonAncestor::AncestorRange;
+
+    // appends all ancestors of 'synsets' with their distances to 'out', sorted by ancestor
+    void ancestor_map(VertexRange synsets, std::vector<AncestorLabels::Entry> & out) const
+    {
+        make_sca(local_workspace()).ancestor_map(synsets, out);
+    }
+
+    // appends ancestor maps of nouns[0, count) to 'out', see ShortestCommonAncestor::ancestor_maps()
+    void ancestor_maps(const std::string_view * nouns,
+                       std::size_t count,
+                       std::vector<AncestorLabels::Entry> & out,
+                       std::vector<std::size_t> & offsets) const
+    {
+        std::vector<VertexRange> synsets;
+        synsets.reserve(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            synsets.push_back(noun_synsets(nouns[i]));
+        }
+        make_sca(local_workspace()).ancestor_maps(synsets.data(), synsets.size(), out, offsets);
+    }
+
+    // returns distance through the nearest common ancestor of two ancestor maps
+    // (std::numeric_limits<unsigned>::max() if there is none)
+    static unsigned merged_distance(AncestorRange a, AncestorRange b)
+    {
+        unsigned min_distance = static_cast<unsigned>(-1);
+        unsigned min_distance_ancestor = 0;
+        ShortestCommonAncestor::merge_ancestor_maps(a, b, min_distance, min_distance_ancestor);
+        return min_distance;
+    }
+
+    // returns 'true' if synset 'vert' has no hypernyms
+    bool is_root(unsigned vert) const
+    {
+        const auto [first, last] = graph.adjacent(vert);
+        return first == last;
+    }
+
+    // returns shortest common ancestor vertex of synset subsets of two nouns and distance between them
+    std::pair<unsigned, unsigned> find_sca_distance(VertexRange synsets1, VertexRange synsets2) const
+    {
+        return make_sca(local_workspace()).ancestor_length(synsets1, synsets2);
+    }
+
+    // returns shortest common ancestor vertex of two nouns and distance between them through the result cache
+    std::pair<unsigned, unsigned> cached_sca_distance(NounId noun1, NounId noun2) const;
+
+    // answers query of API 'api' for a pair of nouns
+    SCAResult find_sca(NounId noun1, NounId noun2, WordNetStats::Api api) const;
+
+    SCAResult find_sca(std::string_view noun1, std::string_view noun2, WordNetStats::Api api) const
+    {
+        return find_sca(resolve_noun(noun1), resolve_noun(noun2), api);
+    }
+};
+
+/**
+ * WordNet that takes updates while it is queried, in the manner of RCU.
+ *
+ * Readers take the current version with get() and query it for as long as
+ * they hold it. apply() builds the next version aside and publishes it with
+ * one atomic pointer swap, so readers are never blocked and never see a
+ * partly applied delta; a version is freed once its last reader drops it.
+ */
+class LiveWordNet
+{
+public:
+    explicit LiveWordNet(WordNet wordnet);
 
-    std::pair<unsigned, unsigned> find_sca_distance(const std::string & noun1, const std::string & noun2) const
+    // returns the latest published version
+    std::shared_ptr<const WordNet> get() const
     {
-        return ShortestCommonAncestor(graph).ancestor_length(
-                word_ids.at(noun1),
-                word_ids.at(noun2));
+        return std::atomic_load(&current);
     }
+
+    // publishes a version with 'delta' applied, see WordNet::with_delta(); updates are applied one at a time
+    void apply(const WordNetDelta & delta);
+
+private:
+    std::shared_ptr<const WordNet> current;
+    std::mutex update_mutex;
 };
 
 class Outcast
@@ -230,6 +1564,58 @@ public:
     // returns outcast word
     std::string outcast(const std::set<std::string> & nouns) const;
 
+    /**
+     * Returns the noun of nouns[0, count) with the largest sum of distances to the others,
+     * or an empty view if that sum is shared by several nouns. Nouns are expected
+     * to be distinct. Pairs are only measured while they can still change the
+     * answer: every noun keeps bounds on its sum and is dropped as soon as its
+     * upper bound falls below the lower bound of another one.
+     */
+    std::string_view outcast(const std::string_view * nouns, std::size_t count) const;
+
 private:
     WordNet & wordnet;
 };
+
+/**
+ * Set of nouns edited one word at a time that keeps the outcast of its members
+ * up to date. Every member keeps its ancestor map and sum of distances, so adding
+ * or removing a word costs one traversal plus one map merge per member.
+ */
+class OutcastSet
+{
+public:
+    explicit OutcastSet(const WordNet & wordnet)
+        : wordnet(wordnet)
+    {
+    }
+
+    // adds 'noun' to the set, returns 'false' if it is already there;
+    // throws std::out_of_range if it is not stored in WordNet
+    bool add(std::string_view noun);
+
+    // removes 'noun' from the set, returns 'false' if it is not there
+    bool remove(std::string_view noun);
+
+    // returns outcast of the current members (empty if there is a tie or less than three members),
+    // the view stays valid as long as WordNet does
+    std::string_view outcast() const;
+
+    std::size_t size() const
+    {
+        return members.size();
+    }
+
+private:
+    struct Member
+    {
+        WordNet::NounId noun;
+        std::vector<AncestorLabels::Entry> ancestors; // sorted by ancestor
+        std::uint64_t distance_sum;
+    };
+
+    const WordNet & wordnet;
+    std::vector<Member> members;
+
+    unsigned member_distance(const Member & a, const Member & b) const;
+};
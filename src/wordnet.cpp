@@ -1,10 +1,37 @@
 #include "wordnet.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <functional>
 #include <istream>
 #include <limits>
+#include <mutex>
 #include <ostream>
-#include <queue>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// WORDNET_COUNT(statement) runs 'statement' only in builds that collect query statistics
+#ifdef WORDNET_STATS
+#define WORDNET_COUNT(statement) statement
+#else
+#define WORDNET_COUNT(statement)
+#endif
 
 namespace {
 
@@ -15,6 +42,330 @@ unsigned string_view_to_unsigned(std::string_view sv)
     return result;
 }
 
+// calls 'f' for every non-empty line of 'text'
+template <class F>
+void for_each_line(std::string_view text, F && f)
+{
+    std::size_t start_pos = 0;
+    while (start_pos < text.size()) {
+        std::size_t end_pos = text.find('\n', start_pos);
+        if (end_pos == std::string_view::npos) {
+            end_pos = text.size();
+        }
+        if (end_pos > start_pos) {
+            f(text.substr(start_pos, end_pos - start_pos));
+        }
+        start_pos = end_pos + 1;
+    }
+}
+
+/**
+ * Persistent worker threads shared by all parallel_for() calls, started on
+ * first use and grown on demand. Workers outlive the calls, so their
+ * thread-local search workspaces stay warm from one batch to the next.
+ * One job runs on the pool at a time; a job posted meanwhile runs on its
+ * calling thread alone rather than waiting for the pool.
+ */
+class WorkerPool
+{
+public:
+    static WorkerPool & instance()
+    {
+        static WorkerPool pool;
+        return pool;
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread & thread : threads) {
+            thread.join();
+        }
+    }
+
+    // runs 'job' on the calling thread and on 'helpers' pool threads at once, returns when all have finished;
+    // a job started from inside another job or while the pool is busy runs on the calling thread only
+    void run(unsigned helpers, const std::function<void()> & job)
+    {
+        thread_local bool inside_job = false;
+        if (inside_job || helpers == 0) {
+            job();
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        if (current != nullptr) {
+            lock.unlock();
+            job();
+            return;
+        }
+        while (threads.size() < helpers) {
+            threads.emplace_back([this] {
+                inside_job = true;
+                work();
+            });
+        }
+        current = &job;
+        unclaimed = helpers;
+        wake.notify_all();
+        lock.unlock();
+
+        inside_job = true;
+        job();
+        inside_job = false;
+
+        lock.lock();
+        // helpers that have not started yet are not waited for, the job has no work left for them
+        unclaimed = 0;
+        finished.wait(lock, [this] {
+            return running == 0;
+        });
+        current = nullptr;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable wake;     // a job is posted or the pool stops
+    std::condition_variable finished; // a helper has finished its part of the job
+    std::vector<std::thread> threads;
+    const std::function<void()> * current = nullptr;
+    unsigned unclaimed = 0; // helpers the current job still asks for
+    unsigned running = 0;   // helpers running the current job
+    bool stopping = false;
+
+    WorkerPool() = default;
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] {
+                return stopping || unclaimed != 0;
+            });
+            if (stopping) {
+                return;
+            }
+            --unclaimed;
+            ++running;
+            const std::function<void()> & job = *current;
+            lock.unlock();
+            job();
+            lock.lock();
+            if (--running == 0) {
+                finished.notify_all();
+            }
+        }
+    }
+};
+
+// runs 'task(i)' for every i in [0, count) on up to 'threads' threads (0 means one per hardware thread),
+// the calling thread included, helped by the pooled workers; the first exception thrown by a task stops
+// the rest and is rethrown
+template <class Task>
+void parallel_for(std::size_t count, unsigned threads, Task && task)
+{
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min<std::size_t>(threads, count);
+    if (threads == 0) {
+        return;
+    }
+
+    std::atomic<std::size_t> next_task{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&] {
+        try {
+            std::size_t i;
+            while ((i = next_task.fetch_add(1)) < count) {
+                task(i);
+            }
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+            next_task = count;
+        }
+    };
+
+    WorkerPool::instance().run(threads - 1, worker);
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+// splits 'text' into at most 'count' pieces of similar size, each ending on a line boundary
+std::vector<std::string_view> split_lines(std::string_view text, unsigned count)
+{
+    std::vector<std::string_view> pieces;
+    std::size_t start_pos = 0;
+    for (unsigned i = 1; i <= count && start_pos < text.size(); ++i) {
+        std::size_t end_pos = text.size();
+        if (i < count) {
+            end_pos = text.find('\n', std::max(start_pos, text.size() / count * i));
+            end_pos = end_pos == std::string_view::npos ? text.size() : end_pos + 1;
+        }
+        pieces.push_back(text.substr(start_pos, end_pos - start_pos));
+        start_pos = end_pos;
+    }
+    return pieces;
+}
+
+// synsets parsed from a piece of the synsets input
+struct SynsetChunk
+{
+    struct Synset
+    {
+        unsigned id;
+        std::string_view gloss;
+    };
+
+    struct Noun
+    {
+        std::string_view name;
+        unsigned synset; // index in 'synsets'
+    };
+
+    std::vector<Synset> synsets;
+    std::vector<Noun> nouns; // sorted by name, nouns with equal names keep input order
+};
+
+void parse_synsets(std::string_view text, SynsetChunk & chunk)
+{
+    for_each_line(text, [&](std::string_view source_line) {
+        const unsigned synset = chunk.synsets.size();
+        std::string_view id_string = source_line.substr(0, source_line.find(','));
+        std::size_t gloss_start = source_line.find(',', id_string.size() + 1) + 1;
+        std::size_t start_pos = id_string.size() + 1;
+        std::size_t end_pos;
+        while ((end_pos = source_line.find(' ', start_pos)) < gloss_start) {
+            chunk.nouns.push_back({source_line.substr(start_pos, end_pos - start_pos), synset});
+            start_pos = end_pos + 1;
+        }
+        chunk.nouns.push_back({source_line.substr(start_pos, gloss_start - 1 - start_pos), synset});
+        chunk.synsets.push_back({string_view_to_unsigned(id_string), source_line.substr(gloss_start)});
+    });
+    std::stable_sort(chunk.nouns.begin(), chunk.nouns.end(), [](const SynsetChunk::Noun & lhs, const SynsetChunk::Noun & rhs) {
+        return lhs.name < rhs.name;
+    });
+}
+
+// hypernym edges (synset id -> synset id) parsed from a piece of the hypernyms input
+using HypernymChunk = std::vector<std::pair<unsigned, unsigned>>;
+
+void parse_hypernyms(std::string_view text, HypernymChunk & chunk)
+{
+    for_each_line(text, [&](std::string_view line) {
+        std::string_view from_string = line.substr(0, line.find(','));
+        if (from_string.size() < line.size()) {
+            unsigned from = string_view_to_unsigned(from_string);
+            std::size_t start_pos = from_string.size() + 1;
+            std::size_t end_pos;
+            while ((end_pos = line.find(',', start_pos)) < line.size()) {
+                chunk.emplace_back(from, string_view_to_unsigned(line.substr(start_pos, end_pos - start_pos)));
+                start_pos = end_pos + 1;
+            }
+            chunk.emplace_back(from, string_view_to_unsigned(line.substr(start_pos)));
+        }
+    });
+}
+
+// nouns are matched up to ASCII case, with spaces and underscores treated alike
+char fold_noun_char(char c)
+{
+    if (c == '_') {
+        return ' ';
+    }
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+bool folded_less(std::string_view lhs, std::string_view rhs)
+{
+    return std::lexicographical_compare(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](char a, char b) {
+        return static_cast<unsigned char>(fold_noun_char(a)) < static_cast<unsigned char>(fold_noun_char(b));
+    });
+}
+
+constexpr char snapshot_magic[8] = {'W', 'N', 'S', 'N', 'A', 'P', '\r', '\n'};
+constexpr std::uint32_t snapshot_version = 6;
+constexpr std::uint32_t snapshot_byte_order = 0x01020304; // images are only readable with the writer's endianness
+constexpr std::size_t snapshot_alignment = 64;
+
+// sections of a snapshot image, in file order
+enum SnapshotSection : std::uint32_t
+{
+    text_section,              // chars, nouns and glosses are ranges of it
+    gloss_text_section,        // chars, glosses are ranges of it if present (saved with lazy glosses)
+    noun_names_section,        // TextRef per noun, sorted by noun
+    noun_vert_offsets_section, // unsigned per noun plus end sentinel
+    noun_verts_section,        // unsigned per synset of every noun
+    vert_noun_offsets_section, // unsigned per vertex plus end sentinel
+    vert_nouns_section,        // unsigned per noun of every synset
+    folded_nouns_section,      // unsigned per noun, in order of case-folded nouns
+    glosses_section,           // TextRef per vertex
+    edge_offsets_section,      // unsigned per vertex plus end sentinel
+    edge_targets_section,      // unsigned per edge
+    reverse_edge_offsets_section, // unsigned per vertex plus end sentinel
+    reverse_edge_targets_section, // unsigned per edge
+    vert_ids_section,          // unsigned per vertex
+    id_vert_index_section,     // unsigned per id, empty for sparse ids
+    depths_section,            // unsigned per vertex
+    up_depths_section,         // unsigned per vertex, empty for cyclic graphs
+    label_offsets_section,     // unsigned per vertex plus end sentinel, empty without label index
+    label_entries_section,     // AncestorLabels::Entry per label entry
+    snapshot_section_count
+};
+
+struct SnapshotHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t section_count;
+    std::uint32_t reserved;
+    std::uint64_t section_offset[snapshot_section_count];
+    std::uint64_t section_size[snapshot_section_count];
+};
+
+std::size_t align_snapshot_offset(std::size_t offset)
+{
+    return (offset + snapshot_alignment - 1) / snapshot_alignment * snapshot_alignment;
+}
+
+// writes all 'size' bytes of 'data' at 'offset' of file descriptor 'fd' of 'path'
+void write_at(int fd, const void * data, std::size_t size, std::size_t offset, const std::string & path)
+{
+    const char * bytes = static_cast<const char *>(data);
+    while (size > 0) {
+        const ssize_t written = ::pwrite(fd, bytes, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "cannot write WordNet snapshot " + path);
+        }
+        bytes += written;
+        size -= written;
+        offset += written;
+    }
+}
+
+template <class T>
+FlatArray<T> snapshot_section(std::string_view image, const SnapshotHeader & header, SnapshotSection section)
+{
+    if (header.section_size[section] % sizeof(T) != 0) {
+        throw std::runtime_error("WordNet snapshot: corrupted section " + std::to_string(section));
+    }
+    return FlatArray<T>::borrow(reinterpret_cast<const T *>(image.data() + header.section_offset[section]),
+                                header.section_size[section] / sizeof(T));
+}
+
 } // anonymous namespace
 
 void Digraph::reset_graph_size(std::size_t size)
@@ -29,15 +380,114 @@ void Digraph::add_edge(unsigned v, unsigned w)
     graph[get_or_add_vert(v)].emplace_back(get_or_add_vert(w));
 }
 
+void Digraph::freeze()
+{
+    std::vector<unsigned> offsets(graph.size() + 1);
+    std::size_t edge_count = 0;
+    for (std::size_t i = 0; i < graph.size(); ++i) {
+        offsets[i] = edge_count;
+        edge_count += graph[i].size();
+    }
+    offsets[graph.size()] = edge_count;
+    std::vector<unsigned> targets;
+    targets.reserve(edge_count);
+    for (const std::vector<unsigned> & neighbours : graph) {
+        targets.insert(targets.end(), neighbours.begin(), neighbours.end());
+    }
+    // reverse edges are grouped by target with a counting sort
+    std::vector<unsigned> reverse_offsets(graph.size() + 1, 0);
+    for (const unsigned to : targets) {
+        ++reverse_offsets[to + 1];
+    }
+    for (std::size_t i = 1; i < reverse_offsets.size(); ++i) {
+        reverse_offsets[i] += reverse_offsets[i - 1];
+    }
+    std::vector<unsigned> reverse_targets(edge_count);
+    std::vector<unsigned> reverse_fill(reverse_offsets.begin(), reverse_offsets.end() - 1);
+    for (std::size_t from = 0; from < graph.size(); ++from) {
+        for (const unsigned to : graph[from]) {
+            reverse_targets[reverse_fill[to]++] = from;
+        }
+    }
+    edge_offsets = std::move(offsets);
+    edge_targets = std::move(targets);
+    reverse_edge_offsets = std::move(reverse_offsets);
+    reverse_edge_targets = std::move(reverse_targets);
+    std::vector<std::vector<unsigned>>().swap(graph);
+
+    unsigned max_id = 0;
+    for (const unsigned id : vert_id_map) {
+        max_id = std::max(max_id, id);
+    }
+    // a direct-indexed table is smaller than the hash map as long as at least a quarter of its slots is used
+    if (!vert_id_map.empty() && max_id / 4 < vert_id_map.size()) {
+        std::vector<unsigned> index(static_cast<std::size_t>(max_id) + 1, no_vert);
+        for (std::size_t i = 0; i < vert_id_map.size(); ++i) {
+            index[vert_id_map[i]] = i;
+        }
+        id_vert_index = std::move(index);
+        std::unordered_map<unsigned, unsigned>().swap(id_vert_map);
+    }
+    vert_ids = std::move(vert_id_map);
+    vert_id_map.clear();
+    index_depths();
+}
+
+void Digraph::index_depths()
+{
+    // a vertex is ordered after all of its ancestors
+    const unsigned size = vert_ids.size();
+    std::vector<unsigned> order;
+    order.reserve(size);
+    SearchWorkspace workspace;
+    const bool acyclic = DigraphTraversal::topological<EdgeDirection::forward>(*this, workspace, [&order](unsigned vert) {
+        order.push_back(vert);
+    });
+
+    // in topological order every vertex is visited after its hypernyms, so one pass over it computes
+    // depth as 1 + smallest depth of a hypernym and the upper bound as the largest bound of a hypernym - 1
+    std::vector<unsigned> vert_depths(size, 0);
+    std::vector<unsigned> vert_up_depths(size, 0);
+    for (const unsigned vert : order) {
+        unsigned depth = std::numeric_limits<unsigned>::max();
+        unsigned up_depth = 0;
+        for (unsigned edge = edge_offsets[vert]; edge != edge_offsets[vert + 1]; ++edge) {
+            depth = std::min(depth, vert_depths[edge_targets[edge]] + 1);
+            up_depth = std::max(up_depth, vert_up_depths[edge_targets[edge]]);
+        }
+        vert_depths[vert] = (depth == std::numeric_limits<unsigned>::max() ? 0 : depth);
+        vert_up_depths[vert] = std::max(vert_depths[vert], up_depth == 0 ? 0 : up_depth - 1);
+    }
+    max_depth = vert_depths.empty() ? 0 : *std::max_element(vert_depths.begin(), vert_depths.end());
+    depths = std::move(vert_depths);
+    if (acyclic) {
+        up_depths = std::move(vert_up_depths);
+    }
+    else {
+        // depths along a cycle are not shortest distances, so they must not bound a search
+        up_depths = FlatArray<unsigned>();
+    }
+}
+
+unsigned Digraph::vert(unsigned v) const
+{
+    unsigned found = find_vert(v);
+    if (found == no_vert) {
+        throw std::out_of_range("Digraph: unknown vertex id " + std::to_string(v));
+    }
+    return found;
+}
+
 std::vector<unsigned> Digraph::get_neighbours(unsigned v) const
 {
-    auto found_vertex = id_vert_map.find(v);
-    if (found_vertex != id_vert_map.end()) {
-        std::vector<unsigned> neighbours = graph[found_vertex->second];
-        for (unsigned & n : neighbours) {
-            n = vert_id_map[n];
+    unsigned found_vertex = find_vert(v);
+    if (found_vertex != no_vert) {
+        std::vector<unsigned> result;
+        result.reserve(neighbours(found_vertex).size());
+        for (const unsigned n : neighbours(found_vertex)) {
+            result.push_back(id(n));
         }
-        return neighbours;
+        return result;
     }
     return {};
 }
@@ -45,10 +495,11 @@ std::vector<unsigned> Digraph::get_neighbours(unsigned v) const
 void Digraph::print(std::ostream & out) const
 {
     out << "vertex: its neighbours\n";
-    for (std::size_t i = 0; i < graph.size(); ++i) {
-        out << vert_id_map[i] << ": ";
-        for (std::size_t j = 0; j < graph[i].size(); ++j) {
-            out << vert_id_map[graph[i][j]] << " ";
+    for (std::size_t i = 0; i < size(); ++i) {
+        out << id(i) << ": ";
+        auto [begin, end] = adjacent(i);
+        for (const unsigned * it = begin; it != end; ++it) {
+            out << id(*it) << " ";
         }
         out << '\n';
     }
@@ -64,115 +515,1764 @@ unsigned Digraph::get_or_add_vert(unsigned v) // id -> vert
     return it->second;
 }
 
-std::pair<unsigned, unsigned> ShortestCommonAncestor::ancestor_length(const std::vector<unsigned> & subset_a,
-                                                                      const std::vector<unsigned> & subset_b) const
+Digraph Digraph::unfrozen_copy() const
+{
+    Digraph copy;
+    copy.reset_graph_size(size());
+    for (unsigned vert = 0; vert < size(); ++vert) {
+        copy.add_vertex(id(vert));
+    }
+    for (unsigned vert = 0; vert < size(); ++vert) {
+        const VertexRange targets = neighbours(vert);
+        copy.graph[vert].assign(targets.begin(), targets.end());
+    }
+    return copy;
+}
+
+void SearchWorkspace::start(std::size_t size)
 {
-    std::vector<unsigned> distance(graph.size());
-    std::vector<char> color(graph.size());
-    std::queue<unsigned> queue;
-    for (const unsigned id : subset_a) {
-        unsigned vert = graph.id_vert_map.at(id);
-        color[vert] = 1;
-        queue.emplace(vert);
+    for (Side & side : sides) {
+        if (side.stamp.size() < size) {
+            side.stamp.resize(size);
+            side.distance.resize(size);
+            side.parent.resize(size);
+            side.queue.resize(size);
+        }
+        side.queue_head = 0;
+        side.queue_tail = 0;
+    }
+    if (++epoch == 0) {
+        for (Side & side : sides) {
+            std::fill(side.stamp.begin(), side.stamp.end(), 0);
+        }
+        epoch = 1;
+    }
+}
+
+void SearchWorkspace::start_lanes(std::size_t size)
+{
+    if (lane_seen.size() < size) {
+        lane_seen.resize(size);
+        lane_frontier.resize(size);
+        lane_next_frontier.resize(size);
+    }
+    lane_level.clear();
+    lane_next_level.clear();
+    lane_touched.clear();
+}
+
+AncestorClosure::AncestorClosure(const Digraph & graph, VertexRange subset, SearchWorkspace & workspace)
+    : graph(graph)
+    , workspace(workspace)
+{
+    workspace.start(graph.size());
+    for (const unsigned vert : subset) {
+        if (!workspace.is_marked(0, vert)) {
+            workspace.mark(0, vert, 0);
+        }
+    }
+}
+
+bool AncestorClosure::reach(std::size_t pos)
+{
+    SearchWorkspace::Side & side = workspace.sides[0];
+    while (pos >= side.queue_tail && side.queue_head != side.queue_tail) {
+        const unsigned from = side.queue[side.queue_head++];
+        for (const unsigned to : graph.neighbours(from)) {
+            if (!workspace.is_marked(0, to)) {
+                workspace.mark(0, to, side.distance[from] + 1);
+            }
+        }
+    }
+    return pos < side.queue_tail;
+}
+
+void AncestorLabels::build(const Digraph & graph, SearchWorkspace & workspace)
+{
+    const ShortestCommonAncestor sca(graph, workspace);
+    std::vector<unsigned> label_offsets(graph.size() + 1);
+    std::vector<Entry> label_entries;
+    for (unsigned vert = 0; vert < graph.size(); ++vert) {
+        label_offsets[vert] = label_entries.size();
+        sca.ancestor_map({&vert, &vert + 1}, label_entries);
+    }
+    label_offsets[graph.size()] = label_entries.size();
+    label_entries.shrink_to_fit();
+    offsets = std::move(label_offsets);
+    entries = std::move(label_entries);
+}
+
+void AncestorLabels::update(const AncestorLabels & previous,
+                            const Digraph & graph,
+                            const std::vector<char> & stale,
+                            SearchWorkspace & workspace)
+{
+    const ShortestCommonAncestor sca(graph, workspace);
+    std::vector<unsigned> label_offsets(graph.size() + 1);
+    std::vector<Entry> label_entries;
+    label_entries.reserve(previous.entries.size());
+    for (unsigned vert = 0; vert < graph.size(); ++vert) {
+        label_offsets[vert] = label_entries.size();
+        if (stale[vert]) {
+            sca.ancestor_map({&vert, &vert + 1}, label_entries);
+        }
+        else {
+            const auto [begin, end] = previous.label(vert);
+            label_entries.insert(label_entries.end(), begin, end);
+        }
+    }
+    label_offsets[graph.size()] = label_entries.size();
+    label_entries.shrink_to_fit();
+    offsets = std::move(label_offsets);
+    entries = std::move(label_entries);
+}
+
+std::pair<unsigned, unsigned> ShortestCommonAncestor::ancestor_length(VertexRange subset_a, VertexRange subset_b) const
+{
+    if (labels != nullptr) {
+        return ancestor_length_by_labels(subset_a, subset_b);
     }
-    for (const unsigned id : subset_b) {
-        unsigned vert = graph.id_vert_map.at(id);
-        if (color[vert] == 1) {
-            return {id, 0};
+    // most nouns have a single synset
+    if (subset_a.size() == 1 && subset_b.size() == 1) {
+        return search(std::array<unsigned, 1>{*subset_a.first}, std::array<unsigned, 1>{*subset_b.first});
+    }
+    return search(subset_a, subset_b);
+}
+
+std::pair<unsigned, unsigned> ShortestCommonAncestor::ancestor_length(unsigned vert_a, unsigned vert_b) const
+{
+    if (labels != nullptr) {
+        return ancestor_length_by_labels({&vert_a, &vert_a + 1}, {&vert_b, &vert_b + 1});
+    }
+    return search(std::array<unsigned, 1>{vert_a}, std::array<unsigned, 1>{vert_b});
+}
+
+template <class SubsetA, class SubsetB>
+std::pair<unsigned, unsigned> ShortestCommonAncestor::search(const SubsetA & subset_a, const SubsetB & subset_b) const
+{
+    workspace.start(graph.size());
+    for (const unsigned vert : subset_a) {
+        if (!workspace.is_marked(0, vert)) {
+            workspace.mark(0, vert, 0);
+        }
+    }
+    for (const unsigned vert : subset_b) {
+        if (workspace.is_marked(0, vert)) {
+            return {vert, 0};
+        }
+        if (!workspace.is_marked(1, vert)) {
+            workspace.mark(1, vert, 0);
         }
-        color[vert] = 2;
-        queue.emplace(vert);
     }
     unsigned min_distance = std::numeric_limits<unsigned>::max();
     unsigned min_distance_ancestor = 0;
-    while (!queue.empty()) {
-        const unsigned vert = queue.front();
-        queue.pop();
-        for (const unsigned to : graph.graph[vert]) {
-            if (color[to] == 0) {
-                color[to] = color[vert];
-                distance[to] = distance[vert] + 1;
-                queue.emplace(to);
-            }
-            else if (color[to] != color[vert]) {
-                unsigned current_distance = distance[to] + distance[vert] + 1;
-                if (current_distance < min_distance) {
-                    min_distance = current_distance;
-                    min_distance_ancestor = to;
+    unsigned depth[2] = {0, 0};
+    // smallest root distance of each subset, which bounds the length of any path through a vertex from below
+    unsigned subset_depth[2] = {0, 0};
+    if (mode == SearchMode::bidirectional && !graph.up_depths.empty()) {
+        const auto min_depth = [this](const auto & subset) {
+            unsigned result = std::numeric_limits<unsigned>::max();
+            for (const unsigned vert : subset) {
+                result = std::min(result, graph.depths[vert]);
+            }
+            return result;
+        };
+        subset_depth[0] = min_depth(subset_a);
+        subset_depth[1] = min_depth(subset_b);
+    }
+    while (true) {
+        // a side stops once every vertex it could still reach is at least as far as the best meeting vertex:
+        // vertices on its next level are 'depth + 1' away from its subset alone
+        bool can_expand[2];
+        for (unsigned side = 0; side < 2; ++side) {
+            const SearchWorkspace::Side & s = workspace.sides[side];
+            can_expand[side] = s.queue_head != s.queue_tail &&
+                    (mode == SearchMode::exhaustive || depth[side] + 1 < min_distance);
+        }
+        if (!can_expand[0] && !can_expand[1]) {
+            break;
+        }
+        unsigned side = can_expand[0] ? 0 : 1;
+        if (can_expand[0] && can_expand[1]) {
+            const SearchWorkspace::Side & a = workspace.sides[0];
+            const SearchWorkspace::Side & b = workspace.sides[1];
+            if (depth[1] < depth[0] ||
+                (depth[1] == depth[0] && b.queue_tail - b.queue_head < a.queue_tail - a.queue_head)) {
+                side = 1;
+            }
+        }
+        expand_level(side, subset_depth[1 - side], min_distance, min_distance_ancestor);
+        ++depth[side];
+    }
+    WORDNET_COUNT(workspace.counters.queue_peak = std::max<std::uint64_t>(
+                          workspace.counters.queue_peak, workspace.sides[0].queue_tail + workspace.sides[1].queue_tail));
+    return {min_distance_ancestor, min_distance};
+}
+
+void ShortestCommonAncestor::ancestor_path(VertexRange subset_a,
+                                           VertexRange subset_b,
+                                           unsigned ancestor,
+                                           std::vector<unsigned> & path) const
+{
+    // each side climbs from its subset until it reaches the ancestor; as the ancestor is a shortest
+    // common one, the two shortest climbs add up to the length of a shortest ancestral path through it
+    workspace.start(graph.size());
+    const VertexRange subsets[2] = {subset_a, subset_b};
+    for (unsigned side = 0; side < 2; ++side) {
+        SearchWorkspace::Side & s = workspace.sides[side];
+        for (const unsigned vert : subsets[side]) {
+            if (!workspace.is_marked(side, vert)) {
+                workspace.mark(side, vert, 0);
+            }
+        }
+        while (!workspace.is_marked(side, ancestor) && s.queue_head != s.queue_tail) {
+            const unsigned vert = s.queue[s.queue_head++];
+            WORDNET_COUNT(++workspace.counters.vertices_visited);
+            WORDNET_COUNT(workspace.counters.edges_scanned += graph.edge_offsets[vert + 1] - graph.edge_offsets[vert]);
+            for (const unsigned to : graph.neighbours(vert)) {
+                if (!workspace.is_marked(side, to)) {
+                    workspace.mark(side, to, s.distance[vert] + 1);
+                    s.parent[to] = vert;
                 }
             }
         }
     }
-    return {graph.vert_id_map[min_distance_ancestor], min_distance};
+    WORDNET_COUNT(workspace.counters.queue_peak = std::max<std::uint64_t>(
+                          workspace.counters.queue_peak, workspace.sides[0].queue_tail + workspace.sides[1].queue_tail));
+    if (!workspace.is_marked(0, ancestor) || !workspace.is_marked(1, ancestor)) {
+        path.clear();
+        return;
+    }
+    trace_path(ancestor, workspace.sides[0].distance[ancestor] + workspace.sides[1].distance[ancestor], path);
 }
 
-WordNet::WordNet(std::istream & synsets, std::istream & hypernyms)
+std::pair<unsigned, unsigned> ShortestCommonAncestor::ancestor_path(VertexRange subset_a,
+                                                                    VertexRange subset_b,
+                                                                    std::vector<unsigned> & path) const
 {
-    std::string line;
-    while (std::getline(synsets, line)) {
-        if (line.empty()) {
-            continue;
+    const auto [ancestor, length] = search(subset_a, subset_b);
+    if (length == std::numeric_limits<unsigned>::max()) {
+        path.clear();
+    }
+    else {
+        trace_path(ancestor, length, path);
+    }
+    return {ancestor, length};
+}
+
+void ShortestCommonAncestor::trace_path(unsigned ancestor, unsigned length, std::vector<unsigned> & path) const
+{
+    // parent pointers of each side lead from the ancestor back to a vertex of its subset
+    const SearchWorkspace::Side & a = workspace.sides[0];
+    const SearchWorkspace::Side & b = workspace.sides[1];
+    path.clear();
+    for (unsigned vert = ancestor; a.distance[vert] != 0;) {
+        vert = a.parent[vert];
+        path.push_back(vert);
+    }
+    std::reverse(path.begin(), path.end());
+    path.push_back(ancestor);
+    // a zero length path is found before side 1 marks the ancestor
+    if (length != 0) {
+        for (unsigned vert = ancestor; b.distance[vert] != 0;) {
+            vert = b.parent[vert];
+            path.push_back(vert);
         }
-        source_lines.emplace_back(std::move(line));
     }
-    for (const std::string & source_line : source_lines) {
-        std::string_view id_string(&source_line[0], source_line.find(','));
-        unsigned id = string_view_to_unsigned(id_string);
-        std::size_t gloss_start = source_line.find(',', id_string.size() + 1) + 1;
-        std::size_t start_pos = id_string.size() + 1;
-        std::size_t end_pos;
-        while ((end_pos = source_line.find(' ', start_pos)) < gloss_start) {
-            word_ids[{&source_line[start_pos], end_pos - start_pos}].emplace_back(id);
-            start_pos = end_pos + 1;
+}
+
+void ShortestCommonAncestor::ancestor_map(VertexRange subset, std::vector<AncestorLabels::Entry> & out) const
+{
+    const auto by_ancestor = [](const AncestorLabels::Entry & lhs, const AncestorLabels::Entry & rhs) {
+        return lhs.ancestor < rhs.ancestor || (lhs.ancestor == rhs.ancestor && lhs.distance < rhs.distance);
+    };
+    const std::size_t map_begin = out.size();
+    if (labels != nullptr) {
+        for (const unsigned vert : subset) {
+            auto [begin, end] = labels->label(vert);
+            out.insert(out.end(), begin, end);
+        }
+        std::sort(out.begin() + map_begin, out.end(), by_ancestor);
+        // keeps the closest entry of every ancestor
+        out.erase(std::unique(out.begin() + map_begin, out.end(), [](const AncestorLabels::Entry & lhs, const AncestorLabels::Entry & rhs) {
+                      return lhs.ancestor == rhs.ancestor;
+                  }),
+                  out.end());
+        return;
+    }
+    DigraphTraversal::breadth_first<EdgeDirection::forward>(graph, subset, workspace, [&out](unsigned vert, unsigned distance) {
+        out.push_back({vert, distance});
+    });
+    std::sort(out.begin() + map_begin, out.end(), by_ancestor);
+}
+
+void ShortestCommonAncestor::ancestor_maps(const VertexRange * subsets,
+                                           std::size_t count,
+                                           std::vector<AncestorLabels::Entry> & out,
+                                           std::vector<std::size_t> & offsets) const
+{
+    offsets.resize(count + 1);
+    if (labels != nullptr) {
+        // merging labels is cheaper than any traversal
+        for (std::size_t i = 0; i < count; ++i) {
+            offsets[i] = out.size();
+            ancestor_map(subsets[i], out);
+        }
+        offsets[count] = out.size();
+        return;
+    }
+    constexpr std::size_t lanes = 64;
+    std::vector<AncestorLabels::Entry> lane_maps[lanes];
+    workspace.start_lanes(graph.size());
+    std::vector<std::uint64_t> & seen = workspace.lane_seen;
+    std::vector<std::uint64_t> & frontier = workspace.lane_frontier;
+    std::vector<std::uint64_t> & next_frontier = workspace.lane_next_frontier;
+    std::vector<unsigned> & level = workspace.lane_level;
+    std::vector<unsigned> & next_level = workspace.lane_next_level;
+    std::vector<unsigned> & touched = workspace.lane_touched;
+    const auto reach = [&](unsigned vert, std::uint64_t lanes_mask, std::vector<std::uint64_t> & masks, std::vector<unsigned> & verts) {
+        if (seen[vert] == 0) {
+            touched.push_back(vert);
+        }
+        seen[vert] |= lanes_mask;
+        if (masks[vert] == 0) {
+            verts.push_back(vert);
+        }
+        masks[vert] |= lanes_mask;
+    };
+    // records vertices of a finished level in the maps of the lanes that reached them
+    const auto record = [&](const std::vector<unsigned> & verts, const std::vector<std::uint64_t> & masks, unsigned distance) {
+        for (const unsigned vert : verts) {
+            for (std::uint64_t bits = masks[vert]; bits != 0; bits &= bits - 1) {
+                lane_maps[__builtin_ctzll(bits)].push_back({vert, distance});
+            }
+        }
+    };
+
+    for (std::size_t batch = 0; batch < count; batch += lanes) {
+        const std::size_t batch_size = std::min(lanes, count - batch);
+        for (std::size_t lane = 0; lane < batch_size; ++lane) {
+            for (const unsigned vert : subsets[batch + lane]) {
+                if ((seen[vert] >> lane & 1) == 0) {
+                    reach(vert, std::uint64_t(1) << lane, frontier, level);
+                }
+            }
+        }
+        record(level, frontier, 0);
+        // every level is expanded for all lanes at once: a vertex shared by several searches
+        // has its edges read once and forwards the whole mask of lanes standing on it
+        for (unsigned distance = 1; !level.empty(); ++distance) {
+            for (const unsigned vert : level) {
+                const std::uint64_t mask = frontier[vert];
+                frontier[vert] = 0;
+                auto [begin, end] = graph.adjacent(vert);
+                for (const unsigned * to = begin; to != end; ++to) {
+                    const std::uint64_t fresh = mask & ~seen[*to];
+                    if (fresh != 0) {
+                        reach(*to, fresh, next_frontier, next_level);
+                    }
+                }
+            }
+            record(next_level, next_frontier, distance);
+            level.clear();
+            level.swap(next_level);
+            frontier.swap(next_frontier);
+        }
+        for (const unsigned vert : touched) {
+            seen[vert] = 0;
+        }
+        touched.clear();
+
+        for (std::size_t lane = 0; lane < batch_size; ++lane) {
+            std::vector<AncestorLabels::Entry> & map = lane_maps[lane];
+            std::sort(map.begin(), map.end(), [](const AncestorLabels::Entry & lhs, const AncestorLabels::Entry & rhs) {
+                return lhs.ancestor < rhs.ancestor;
+            });
+            offsets[batch + lane] = out.size();
+            out.insert(out.end(), map.begin(), map.end());
+            map.clear();
+        }
+    }
+    offsets[count] = out.size();
+}
+
+void ShortestCommonAncestor::merge_ancestor_maps(AncestorRange a,
+                                                 AncestorRange b,
+                                                 unsigned & min_distance,
+                                                 unsigned & min_distance_ancestor)
+{
+    // both maps are sorted by ancestor, so common ancestors are found by a single merge pass
+    while (a.first != a.second && b.first != b.second) {
+        if (a.first->ancestor < b.first->ancestor) {
+            ++a.first;
+        }
+        else if (b.first->ancestor < a.first->ancestor) {
+            ++b.first;
+        }
+        else {
+            if (a.first->distance + b.first->distance < min_distance) {
+                min_distance = a.first->distance + b.first->distance;
+                min_distance_ancestor = a.first->ancestor;
+            }
+            ++a.first;
+            ++b.first;
+        }
+    }
+}
+
+std::pair<unsigned, unsigned> ShortestCommonAncestor::ancestor_length_by_labels(VertexRange subset_a,
+                                                                                VertexRange subset_b) const
+{
+    unsigned min_distance = std::numeric_limits<unsigned>::max();
+    unsigned min_distance_ancestor = 0;
+    for (const unsigned vert_a : subset_a) {
+        for (const unsigned vert_b : subset_b) {
+            merge_ancestor_maps(labels->label(vert_a), labels->label(vert_b), min_distance, min_distance_ancestor);
         }
-        word_ids[{&source_line[start_pos], gloss_start - 1 - start_pos}].emplace_back(id);
-        glosses[id] = {&source_line[gloss_start], source_line.size() - gloss_start};
     }
+    return {min_distance_ancestor, min_distance};
+}
 
-    graph.reset_graph_size(source_lines.size());
-    while (std::getline(hypernyms, line)) {
-        if (line.empty()) {
+void ShortestCommonAncestor::expand_level(unsigned side,
+                                          unsigned other_depth,
+                                          unsigned & min_distance,
+                                          unsigned & min_distance_ancestor) const
+{
+    SearchWorkspace::Side & s = workspace.sides[side];
+    const SearchWorkspace::Side & other = workspace.sides[1 - side];
+    const unsigned * targets = graph.edge_targets.data();
+    // only a bidirectional search skips vertices that cannot lead to a shorter path
+    const unsigned * up_depths =
+            mode != SearchMode::bidirectional || graph.up_depths.empty() ? nullptr : graph.up_depths.data();
+    const std::size_t level_end = s.queue_tail;
+    while (s.queue_head != level_end) {
+        const unsigned vert = s.queue[s.queue_head++];
+        // a meeting at ancestor y of 'vert' costs at least distance[vert] + d(vert, y) + other_depth - depth(y),
+        // which is never below distance[vert] + other_depth - up_depths[vert]
+        if (up_depths != nullptr &&
+            std::uint64_t(s.distance[vert]) + other_depth >= std::uint64_t(min_distance) + up_depths[vert]) {
             continue;
         }
-        std::string_view from_string(&line[0], line.find(','));
-        if (from_string.size() < line.size()) {
-            unsigned from = string_view_to_unsigned(from_string);
-            std::size_t start_pos = from_string.size() + 1;
-            std::size_t end_pos;
-            while ((end_pos = line.find(',', start_pos)) < line.size()) {
-                graph.add_edge(from, string_view_to_unsigned({&line[start_pos], end_pos - start_pos}));
-                start_pos = end_pos + 1;
+        const unsigned to_distance = s.distance[vert] + 1;
+        const unsigned * edges_end = targets + graph.edge_offsets[vert + 1];
+        WORDNET_COUNT(++workspace.counters.vertices_visited);
+        WORDNET_COUNT(workspace.counters.edges_scanned += graph.edge_offsets[vert + 1] - graph.edge_offsets[vert]);
+        for (const unsigned * edge = targets + graph.edge_offsets[vert]; edge != edges_end; ++edge) {
+            const unsigned to = *edge;
+            if (workspace.is_marked(side, to)) {
+                continue;
+            }
+            workspace.mark(side, to, to_distance);
+            s.parent[to] = vert;
+            if (workspace.is_marked(1 - side, to)) {
+                unsigned current_distance = to_distance + other.distance[to];
+                if (current_distance < min_distance) {
+                    min_distance = current_distance;
+                    min_distance_ancestor = to;
+                }
             }
-            graph.add_edge(from, string_view_to_unsigned({&line[start_pos], line.size() - start_pos}));
         }
     }
 }
 
-std::string Outcast::outcast(const std::set<std::string> & nouns) const
+SourceBuffer::SourceBuffer(SourceBuffer && other) noexcept
+    : data(other.data)
+    , size(other.size)
+    , mapped(other.mapped)
+    , heap(std::move(other.heap))
+{
+    other.data = nullptr;
+    other.size = 0;
+    other.mapped = false;
+}
+
+SourceBuffer & SourceBuffer::operator=(SourceBuffer && other) noexcept
+{
+    if (this != &other) {
+        release();
+        data = other.data;
+        size = other.size;
+        mapped = other.mapped;
+        heap = std::move(other.heap);
+        other.data = nullptr;
+        other.size = 0;
+        other.mapped = false;
+    }
+    return *this;
+}
+
+SourceBuffer::~SourceBuffer()
+{
+    release();
+}
+
+void SourceBuffer::release()
+{
+    if (mapped) {
+        ::munmap(const_cast<char *>(data), size);
+    }
+    heap.reset();
+    data = nullptr;
+    size = 0;
+    mapped = false;
+}
+
+SourceBuffer SourceBuffer::map_file(const std::string & path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot open " + path);
+    }
+    return map_descriptor(fd, path);
+}
+
+SourceBuffer SourceBuffer::map_shared_memory(const std::string & name)
+{
+    int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot open shared memory " + name);
+    }
+    return map_descriptor(fd, name);
+}
+
+SourceBuffer SourceBuffer::map_descriptor(int fd, const std::string & path)
+{
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0) {
+        int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "cannot stat " + path);
+    }
+    SourceBuffer buffer;
+    if (file_stat.st_size > 0) {
+        void * address = ::mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED) {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "cannot map " + path);
+        }
+        buffer.data = static_cast<const char *>(address);
+        buffer.size = file_stat.st_size;
+        buffer.mapped = true;
+    }
+    ::close(fd);
+    return buffer;
+}
+
+SourceBuffer SourceBuffer::read_stream(std::istream & in)
+{
+    SourceBuffer buffer;
+    std::size_t capacity = 0;
+    while (in) {
+        if (buffer.size == capacity) {
+            capacity = std::max<std::size_t>(capacity * 2, 1 << 16);
+            std::unique_ptr<char[]> grown(new char[capacity]);
+            if (buffer.size > 0) {
+                std::memcpy(grown.get(), buffer.heap.get(), buffer.size);
+            }
+            buffer.heap = std::move(grown);
+        }
+        in.read(buffer.heap.get() + buffer.size, capacity - buffer.size);
+        buffer.size += in.gcount();
+    }
+    buffer.data = buffer.heap.get();
+    return buffer;
+}
+
+// entries of a shard live in one array and form a doubly linked recency list,
+// so hits and evictions only relink slots and never allocate
+struct ResultCache::Shard
+{
+    static constexpr unsigned none = std::numeric_limits<unsigned>::max();
+
+    struct Entry
+    {
+        std::uint64_t key;
+        std::pair<unsigned, unsigned> result;
+        unsigned prev;
+        unsigned next;
+    };
+
+    std::mutex mutex;
+    std::vector<Entry> entries;
+    std::unordered_map<std::uint64_t, unsigned> slots; // key -> index in 'entries'
+    std::size_t capacity = 0;
+    unsigned head = none; // most recently used
+    unsigned tail = none; // least recently used
+    std::atomic<std::uint64_t> hits{0};
+    std::atomic<std::uint64_t> misses{0};
+
+    void unlink(unsigned slot)
+    {
+        Entry & entry = entries[slot];
+        (entry.prev == none ? head : entries[entry.prev].next) = entry.next;
+        (entry.next == none ? tail : entries[entry.next].prev) = entry.prev;
+    }
+
+    void push_front(unsigned slot)
+    {
+        entries[slot].prev = none;
+        entries[slot].next = head;
+        (head == none ? tail : entries[head].prev) = slot;
+        head = slot;
+    }
+};
+
+ResultCache::ResultCache(std::size_t capacity, unsigned shards)
+    : capacity(capacity)
+    , shard_count(static_cast<unsigned>(std::max<std::size_t>(1, std::min<std::size_t>(shards, capacity))))
+{
+    // shard capacities add up to 'capacity' exactly, the first 'capacity % shard_count' shards take one more pair
+    this->shards = std::make_unique<Shard[]>(shard_count);
+    for (unsigned i = 0; i < shard_count; ++i) {
+        const std::size_t shard_capacity = capacity / shard_count + (i < capacity % shard_count ? 1 : 0);
+        this->shards[i].capacity = shard_capacity;
+        this->shards[i].slots.reserve(shard_capacity);
+    }
+}
+
+ResultCache::~ResultCache() = default;
+
+std::uint64_t ResultCache::key(unsigned noun1, unsigned noun2)
+{
+    if (noun2 < noun1) {
+        std::swap(noun1, noun2);
+    }
+    return (static_cast<std::uint64_t>(noun1) << 32) | noun2;
+}
+
+ResultCache::Shard & ResultCache::shard_of(std::uint64_t key) const
+{
+    // high bits of a multiplicative hash, so neighbouring keys land in different shards
+    return shards[((key * 0x9E3779B97F4A7C15ull) >> 32) % shard_count];
+}
+
+bool ResultCache::find(unsigned noun1, unsigned noun2, std::pair<unsigned, unsigned> & result)
+{
+    const std::uint64_t k = key(noun1, noun2);
+    Shard & shard = shard_of(k);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.slots.find(k);
+    if (it == shard.slots.end()) {
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    shard.hits.fetch_add(1, std::memory_order_relaxed);
+    if (shard.head != it->second) {
+        shard.unlink(it->second);
+        shard.push_front(it->second);
+    }
+    result = shard.entries[it->second].result;
+    return true;
+}
+
+void ResultCache::insert(unsigned noun1, unsigned noun2, std::pair<unsigned, unsigned> result)
+{
+    const std::uint64_t k = key(noun1, noun2);
+    Shard & shard = shard_of(k);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.slots.count(k) != 0 || shard.capacity == 0) {
+        // another thread has computed the same pair meanwhile, or the cache holds nothing
+        return;
+    }
+    unsigned slot;
+    if (shard.entries.size() < shard.capacity) {
+        slot = shard.entries.size();
+        shard.entries.push_back({});
+    }
+    else {
+        slot = shard.tail;
+        shard.unlink(slot);
+        shard.slots.erase(shard.entries[slot].key);
+    }
+    shard.entries[slot].key = k;
+    shard.entries[slot].result = result;
+    shard.push_front(slot);
+    shard.slots.emplace(k, slot);
+}
+
+ResultCache::Stats ResultCache::stats() const
+{
+    Stats result;
+    for (unsigned i = 0; i < shard_count; ++i) {
+        Shard & shard = shards[i];
+        result.hits += shard.hits.load(std::memory_order_relaxed);
+        result.misses += shard.misses.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        result.size += shard.slots.size();
+    }
+    return result;
+}
+
+void ResultCache::clear()
+{
+    for (unsigned i = 0; i < shard_count; ++i) {
+        Shard & shard = shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.entries.clear();
+        shard.slots.clear();
+        shard.head = shard.tail = Shard::none;
+    }
+}
+
+std::vector<ResultCache::Item> ResultCache::items() const
+{
+    std::vector<Item> result;
+    for (unsigned i = 0; i < shard_count; ++i) {
+        Shard & shard = shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (unsigned slot = shard.tail; slot != Shard::none; slot = shard.entries[slot].prev) {
+            const Shard::Entry & entry = shard.entries[slot];
+            result.push_back({static_cast<unsigned>(entry.key >> 32), static_cast<unsigned>(entry.key), entry.result});
+        }
+    }
+    return result;
+}
+
+std::unique_ptr<ResultCache> ResultCache::clone_empty() const
+{
+    return std::make_unique<ResultCache>(capacity, shard_count);
+}
+
+struct WordNet::StatsCounters
+{
+    std::atomic<std::uint64_t> searches{0};
+    std::atomic<std::uint64_t> vertices_visited{0};
+    std::atomic<std::uint64_t> edges_scanned{0};
+    std::atomic<std::uint64_t> queue_peak{0};
+    std::atomic<std::uint64_t> lookup_failures{0};
+    std::atomic<std::uint64_t> calls[WordNetStats::api_count] = {};
+    std::atomic<std::uint64_t> latency[WordNetStats::api_count][WordNetStats::latency_buckets] = {};
+
+    void add_search(const SearchWorkspace::Counters & search)
+    {
+        searches.fetch_add(1, std::memory_order_relaxed);
+        vertices_visited.fetch_add(search.vertices_visited, std::memory_order_relaxed);
+        edges_scanned.fetch_add(search.edges_scanned, std::memory_order_relaxed);
+        std::uint64_t peak = queue_peak.load(std::memory_order_relaxed);
+        while (search.queue_peak > peak && !queue_peak.compare_exchange_weak(peak, search.queue_peak, std::memory_order_relaxed)) {
+        }
+    }
+
+    void add_call(WordNetStats::Api api, std::chrono::steady_clock::duration elapsed)
+    {
+        const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        std::size_t bucket = 0;
+        while (bucket + 1 < WordNetStats::latency_buckets && (nanoseconds >> (bucket + 1)) != 0) {
+            ++bucket;
+        }
+        calls[api].fetch_add(1, std::memory_order_relaxed);
+        latency[api][bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+// measures one call of a public API, does nothing in builds without statistics
+class WordNet::ApiTimer
+{
+public:
+    ApiTimer(StatsCounters * counters, WordNetStats::Api api)
+#ifdef WORDNET_STATS
+        : counters(counters)
+        , api(api)
+        , start(std::chrono::steady_clock::now())
+#endif
+    {
+        static_cast<void>(counters);
+        static_cast<void>(api);
+    }
+
+#ifdef WORDNET_STATS
+    ~ApiTimer()
+    {
+        if (counters != nullptr) {
+            counters->add_call(api, std::chrono::steady_clock::now() - start);
+        }
+    }
+
+private:
+    StatsCounters * counters;
+    WordNetStats::Api api;
+    std::chrono::steady_clock::time_point start;
+#endif
+};
+
+void SourceBuffer::discard_pages() const
+{
+    if (mapped && size != 0) {
+        // advisory only: if the system keeps the pages, they simply stay resident
+        ::madvise(const_cast<char *>(data), size, MADV_DONTNEED);
+    }
+}
+
+WordNet::WordNet(WordNet && other) noexcept = default;
+
+WordNet & WordNet::operator=(WordNet && other) noexcept = default;
+
+WordNet::~WordNet() = default;
+
+WordNet::WordNet(std::istream & synsets, std::istream & hypernyms, const WordNetOptions & options)
+    : WordNet(SourceBuffer::read_stream(synsets), SourceBuffer::read_stream(hypernyms), options)
+{
+}
+
+WordNet WordNet::from_files(const std::string & synsets_path,
+                            const std::string & hypernyms_path,
+                            const WordNetOptions & options)
+{
+    return WordNet(SourceBuffer::map_file(synsets_path), SourceBuffer::map_file(hypernyms_path), options);
+}
+
+WordNet::WordNet(const WordNetOptions & options)
+    : search_mode(options.search_mode)
+{
+    if (options.cache_capacity > 0) {
+        cache = std::make_unique<ResultCache>(options.cache_capacity, options.cache_shards);
+    }
+    WORDNET_COUNT(counters = std::make_unique<StatsCounters>());
+}
+
+WordNet::WordNet(SourceBuffer synsets, const SourceBuffer & hypernyms, const WordNetOptions & options)
+    : WordNet(options)
+{
+    source = std::move(synsets);
+    text = source.view();
+    gloss_text = text;
+    load(hypernyms.view(), options.load_threads);
+    graph.freeze();
+    if (options.build_label_index) {
+        labels.build(graph, local_workspace());
+    }
+    if (options.lazy_glosses && source.is_mapped()) {
+        make_glosses_lazy();
+    }
+}
+
+void WordNet::load(std::string_view hypernyms_text, unsigned threads)
+{
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // both inputs are cut into pieces on line boundaries and all pieces are parsed concurrently
+    // into partial tables, which are then merged in input order
+    const std::vector<std::string_view> synset_pieces = split_lines(text, threads);
+    const std::vector<std::string_view> hypernym_pieces = split_lines(hypernyms_text, threads);
+    std::vector<SynsetChunk> synset_chunks(synset_pieces.size());
+    std::vector<HypernymChunk> hypernym_chunks(hypernym_pieces.size());
+    parallel_for(synset_pieces.size() + hypernym_pieces.size(), threads, [&](std::size_t i) {
+        if (i < synset_pieces.size()) {
+            parse_synsets(synset_pieces[i], synset_chunks[i]);
+        }
+        else {
+            parse_hypernyms(hypernym_pieces[i - synset_pieces.size()], hypernym_chunks[i - synset_pieces.size()]);
+        }
+    });
+
+    std::size_t synset_count = 0;
+    std::size_t noun_count = 0;
+    for (const SynsetChunk & chunk : synset_chunks) {
+        synset_count += chunk.synsets.size();
+        noun_count += chunk.nouns.size();
+    }
+    graph.reset_graph_size(synset_count);
+    std::vector<TextRef> gloss_refs;
+    gloss_refs.reserve(synset_count);
+    // (noun, vertex) pairs of all chunks; every chunk adds a sorted run
+    std::vector<std::pair<std::string_view, unsigned>> noun_synset_pairs;
+    noun_synset_pairs.reserve(noun_count);
+    std::vector<std::size_t> run_ends;
+    std::vector<unsigned> chunk_verts;
+    for (const SynsetChunk & chunk : synset_chunks) {
+        chunk_verts.clear();
+        for (const SynsetChunk::Synset & synset : chunk.synsets) {
+            unsigned vert = graph.add_vertex(synset.id);
+            chunk_verts.push_back(vert);
+            if (gloss_refs.size() <= vert) {
+                gloss_refs.resize(vert + 1);
+            }
+            gloss_refs[vert] = {static_cast<unsigned>(synset.gloss.data() - text.data()),
+                                static_cast<unsigned>(synset.gloss.size())};
+        }
+        for (const SynsetChunk::Noun & noun : chunk.nouns) {
+            noun_synset_pairs.emplace_back(noun.name, chunk_verts[noun.synset]);
+        }
+        run_ends.push_back(noun_synset_pairs.size());
+    }
+    glosses = std::move(gloss_refs);
+
+    // stable merge of the runs keeps synsets of every noun in input order
+    const auto by_name = [](const auto & lhs, const auto & rhs) {
+        return lhs.first < rhs.first;
+    };
+    for (std::size_t i = 1; i < run_ends.size(); ++i) {
+        std::inplace_merge(noun_synset_pairs.begin(),
+                           noun_synset_pairs.begin() + run_ends[i - 1],
+                           noun_synset_pairs.begin() + run_ends[i],
+                           by_name);
+    }
+    std::vector<TextRef> names;
+    std::vector<unsigned> vert_offsets;
+    std::vector<unsigned> verts;
+    verts.reserve(noun_synset_pairs.size());
+    for (const auto & [name, vert] : noun_synset_pairs) {
+        if (names.empty() || text_of(names.back()) != name) {
+            names.push_back({static_cast<unsigned>(name.data() - text.data()), static_cast<unsigned>(name.size())});
+            vert_offsets.push_back(verts.size());
+        }
+        verts.push_back(vert);
+    }
+    vert_offsets.push_back(verts.size());
+    noun_names = std::move(names);
+    noun_vert_offsets = std::move(vert_offsets);
+    noun_verts = std::move(verts);
+    index_vert_nouns();
+    index_folded_nouns();
+
+    for (const HypernymChunk & chunk : hypernym_chunks) {
+        for (const auto & [from, to] : chunk) {
+            graph.add_edge(from, to);
+        }
+    }
+}
+
+void WordNet::index_vert_nouns()
+{
+    // inverse table, vertex -> nouns, grouped with a counting sort
+    std::vector<unsigned> noun_offsets(glosses.size() + 1, 0);
+    for (const unsigned vert : noun_verts) {
+        ++noun_offsets[vert + 1];
+    }
+    for (std::size_t i = 1; i < noun_offsets.size(); ++i) {
+        noun_offsets[i] += noun_offsets[i - 1];
+    }
+    std::vector<unsigned> nouns_of_verts(noun_verts.size());
+    std::vector<unsigned> noun_fill(noun_offsets.begin(), noun_offsets.end() - 1);
+    for (std::size_t noun = 0; noun < noun_names.size(); ++noun) {
+        for (unsigned i = noun_vert_offsets[noun]; i < noun_vert_offsets[noun + 1]; ++i) {
+            nouns_of_verts[noun_fill[noun_verts[i]]++] = noun;
+        }
+    }
+    vert_noun_offsets = std::move(noun_offsets);
+    vert_nouns = std::move(nouns_of_verts);
+}
+
+void WordNet::make_glosses_lazy()
+{
+    std::size_t size = 0;
+    for (const TextRef & name : noun_names) {
+        size += name.length;
+    }
+    std::vector<char> nouns;
+    nouns.reserve(size);
+    std::vector<TextRef> names;
+    names.reserve(noun_names.size());
+    for (const TextRef & name : noun_names) {
+        const std::string_view noun = text_of(name);
+        names.push_back({static_cast<unsigned>(nouns.size()), name.length});
+        nouns.insert(nouns.end(), noun.begin(), noun.end());
+    }
+    compact_nouns = std::move(nouns);
+    noun_names = std::move(names);
+    text = std::string_view(compact_nouns.data(), compact_nouns.size());
+    source.discard_pages();
+}
+
+WordNet::NounId WordNet::noun_id(std::string_view noun) const
+{
+    // the sorted table is searched with the string_view itself, no key string is built
+    const TextRef * found = std::lower_bound(noun_names.begin(), noun_names.end(), noun, [this](const TextRef & name, std::string_view key) {
+        return text_of(name) < key;
+    });
+    if (found == noun_names.end() || text_of(*found) != noun) {
+        WORDNET_COUNT(counters->lookup_failures.fetch_add(1, std::memory_order_relaxed));
+        return {};
+    }
+    return NounId(found - noun_names.begin());
+}
+
+WordNet::Nouns WordNet::nouns_with_prefix(std::string_view prefix) const
+{
+    // nouns sharing a prefix are adjacent in the sorted table
+    const TextRef * first = std::lower_bound(noun_names.begin(), noun_names.end(), prefix, [this](const TextRef & name, std::string_view key) {
+        return text_of(name) < key;
+    });
+    const TextRef * last = std::partition_point(first, noun_names.end(), [this, prefix](const TextRef & name) {
+        return text_of(name).substr(0, prefix.size()) == prefix;
+    });
+    return Nouns(*this, first, last);
+}
+
+void WordNet::index_folded_nouns()
+{
+    std::vector<unsigned> order(noun_names.size());
+    for (unsigned noun = 0; noun < order.size(); ++noun) {
+        order[noun] = noun;
+    }
+    std::stable_sort(order.begin(), order.end(), [this](unsigned lhs, unsigned rhs) {
+        return folded_less(text_of(noun_names[lhs]), text_of(noun_names[rhs]));
+    });
+    folded_nouns = std::move(order);
+}
+
+void WordNet::append_folded_matches(std::string_view word, std::vector<NounId> & out) const
+{
+    const unsigned * first = std::lower_bound(folded_nouns.begin(), folded_nouns.end(), word, [this](unsigned noun, std::string_view key) {
+        return folded_less(text_of(noun_names[noun]), key);
+    });
+    const unsigned * last = std::upper_bound(first, folded_nouns.end(), word, [this](std::string_view key, unsigned noun) {
+        return folded_less(key, text_of(noun_names[noun]));
+    });
+    for (const unsigned * noun = first; noun != last; ++noun) {
+        if (std::find(out.begin(), out.end(), NounId(*noun)) == out.end()) {
+            out.push_back(NounId(*noun));
+        }
+    }
+}
+
+std::vector<WordNet::NounId> WordNet::match_nouns(std::string_view word) const
+{
+    std::vector<NounId> result;
+    const NounId exact = noun_id(word);
+    if (exact.valid()) {
+        result.push_back(exact);
+    }
+    append_folded_matches(word, result);
+    const auto ends_with = [word](std::string_view suffix) {
+        if (word.size() <= suffix.size()) {
+            return false;
+        }
+        for (std::size_t i = 0; i < suffix.size(); ++i) {
+            if (fold_noun_char(word[word.size() - suffix.size() + i]) != suffix[i]) {
+                return false;
+            }
+        }
+        return true;
+    };
+    if (result.empty() && ends_with("ies")) {
+        std::string singular(word.substr(0, word.size() - 3));
+        singular.push_back('y');
+        append_folded_matches(singular, result);
+    }
+    if (result.empty() && ends_with("es")) {
+        append_folded_matches(word.substr(0, word.size() - 2), result);
+    }
+    if (result.empty() && ends_with("s")) {
+        append_folded_matches(word.substr(0, word.size() - 1), result);
+    }
+    return result;
+}
+
+WordNet WordNet::open_snapshot(const std::string & path, const WordNetOptions & options)
+{
+    return open_snapshot_image(SourceBuffer::map_file(path), path, options);
+}
+
+WordNet WordNet::attach_shared(const std::string & name, const WordNetOptions & options)
+{
+    return open_snapshot_image(SourceBuffer::map_shared_memory(name), name, options);
+}
+
+WordNet WordNet::open_snapshot_image(SourceBuffer image_buffer, const std::string & origin, const WordNetOptions & options)
+{
+    WordNet wordnet(options);
+    wordnet.source = std::move(image_buffer);
+    const std::string_view image = wordnet.source.view();
+
+    SnapshotHeader header;
+    if (image.size() < sizeof(header)) {
+        throw std::runtime_error(origin + ": not a WordNet snapshot");
+    }
+    std::memcpy(&header, image.data(), sizeof(header));
+    if (std::memcmp(header.magic, snapshot_magic, sizeof(snapshot_magic)) != 0 ||
+        header.byte_order != snapshot_byte_order) {
+        throw std::runtime_error(origin + ": not a WordNet snapshot");
+    }
+    if (header.version != snapshot_version || header.section_count != snapshot_section_count) {
+        throw std::runtime_error(origin + ": unsupported WordNet snapshot version " + std::to_string(header.version));
+    }
+    for (std::uint32_t i = 0; i < snapshot_section_count; ++i) {
+        if (header.section_offset[i] % snapshot_alignment != 0 || header.section_offset[i] > image.size() ||
+            header.section_size[i] > image.size() - header.section_offset[i]) {
+            throw std::runtime_error(origin + ": corrupted WordNet snapshot");
+        }
+    }
+
+    wordnet.text = image.substr(header.section_offset[text_section], header.section_size[text_section]);
+    wordnet.gloss_text = header.section_size[gloss_text_section] == 0
+            ? wordnet.text
+            : image.substr(header.section_offset[gloss_text_section], header.section_size[gloss_text_section]);
+    wordnet.noun_names = snapshot_section<TextRef>(image, header, noun_names_section);
+    wordnet.noun_vert_offsets = snapshot_section<unsigned>(image, header, noun_vert_offsets_section);
+    wordnet.noun_verts = snapshot_section<unsigned>(image, header, noun_verts_section);
+    wordnet.vert_noun_offsets = snapshot_section<unsigned>(image, header, vert_noun_offsets_section);
+    wordnet.vert_nouns = snapshot_section<unsigned>(image, header, vert_nouns_section);
+    wordnet.folded_nouns = snapshot_section<unsigned>(image, header, folded_nouns_section);
+    wordnet.glosses = snapshot_section<TextRef>(image, header, glosses_section);
+    Digraph & graph = wordnet.graph;
+    graph.edge_offsets = snapshot_section<unsigned>(image, header, edge_offsets_section);
+    graph.edge_targets = snapshot_section<unsigned>(image, header, edge_targets_section);
+    graph.reverse_edge_offsets = snapshot_section<unsigned>(image, header, reverse_edge_offsets_section);
+    graph.reverse_edge_targets = snapshot_section<unsigned>(image, header, reverse_edge_targets_section);
+    graph.vert_ids = snapshot_section<unsigned>(image, header, vert_ids_section);
+    graph.id_vert_index = snapshot_section<unsigned>(image, header, id_vert_index_section);
+    graph.depths = snapshot_section<unsigned>(image, header, depths_section);
+    graph.up_depths = snapshot_section<unsigned>(image, header, up_depths_section);
+    graph.max_depth = graph.depths.empty() ? 0 : *std::max_element(graph.depths.begin(), graph.depths.end());
+    wordnet.labels.offsets = snapshot_section<unsigned>(image, header, label_offsets_section);
+    wordnet.labels.entries = snapshot_section<AncestorLabels::Entry>(image, header, label_entries_section);
+    if (wordnet.noun_vert_offsets.size() != wordnet.noun_names.size() + 1 ||
+        graph.edge_offsets.size() != graph.vert_ids.size() + 1 ||
+        graph.reverse_edge_offsets.size() != graph.vert_ids.size() + 1 ||
+        graph.reverse_edge_targets.size() != graph.edge_targets.size() ||
+        wordnet.vert_noun_offsets.size() != graph.vert_ids.size() + 1 || wordnet.vert_nouns.size() != wordnet.noun_verts.size() ||
+        wordnet.folded_nouns.size() != wordnet.noun_names.size() ||
+        graph.depths.size() != graph.vert_ids.size() ||
+        (!graph.up_depths.empty() && graph.up_depths.size() != graph.vert_ids.size()) ||
+        (!wordnet.labels.empty() && wordnet.labels.offsets.size() != graph.vert_ids.size() + 1)) {
+        throw std::runtime_error(origin + ": corrupted WordNet snapshot");
+    }
+
+    if (graph.id_vert_index.empty()) {
+        // sparse ids are looked up through a hash map, which has to be rebuilt
+        graph.id_vert_map.reserve(graph.vert_ids.size());
+        for (unsigned vert = 0; vert < graph.vert_ids.size(); ++vert) {
+            graph.id_vert_map.emplace(graph.vert_ids[vert], vert);
+        }
+    }
+    if (wordnet.labels.empty() && options.build_label_index) {
+        wordnet.labels.build(graph, local_workspace());
+    }
+    return wordnet;
+}
+
+void WordNet::write_snapshot(int fd, const std::string & path) const
+{
+    struct Section
+    {
+        const void * data;
+        std::size_t size;
+    };
+    const Section sections[snapshot_section_count] = {
+            {text.data(), text.size()},
+            {gloss_text.data() == text.data() ? nullptr : gloss_text.data(), gloss_text.data() == text.data() ? 0 : gloss_text.size()},
+            {noun_names.data(), noun_names.byte_size()},
+            {noun_vert_offsets.data(), noun_vert_offsets.byte_size()},
+            {noun_verts.data(), noun_verts.byte_size()},
+            {vert_noun_offsets.data(), vert_noun_offsets.byte_size()},
+            {vert_nouns.data(), vert_nouns.byte_size()},
+            {folded_nouns.data(), folded_nouns.byte_size()},
+            {glosses.data(), glosses.byte_size()},
+            {graph.edge_offsets.data(), graph.edge_offsets.byte_size()},
+            {graph.edge_targets.data(), graph.edge_targets.byte_size()},
+            {graph.reverse_edge_offsets.data(), graph.reverse_edge_offsets.byte_size()},
+            {graph.reverse_edge_targets.data(), graph.reverse_edge_targets.byte_size()},
+            {graph.vert_ids.data(), graph.vert_ids.byte_size()},
+            {graph.id_vert_index.data(), graph.id_vert_index.byte_size()},
+            {graph.depths.data(), graph.depths.byte_size()},
+            {graph.up_depths.data(), graph.up_depths.byte_size()},
+            {labels.offsets.data(), labels.offsets.byte_size()},
+            {labels.entries.data(), labels.entries.byte_size()},
+    };
+
+    SnapshotHeader header = {};
+    std::memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+    header.version = snapshot_version;
+    header.byte_order = snapshot_byte_order;
+    header.section_count = snapshot_section_count;
+    std::size_t offset = align_snapshot_offset(sizeof(header));
+    for (std::uint32_t i = 0; i < snapshot_section_count; ++i) {
+        header.section_offset[i] = offset;
+        header.section_size[i] = sections[i].size;
+        offset = align_snapshot_offset(offset + sections[i].size);
+    }
+
+    // the image is sized up front, so padding between sections reads as zeros
+    const std::size_t image_size = header.section_offset[snapshot_section_count - 1] + sections[snapshot_section_count - 1].size;
+    if (::ftruncate(fd, image_size) != 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot write WordNet snapshot " + path);
+    }
+    for (std::uint32_t i = 0; i < snapshot_section_count; ++i) {
+        write_at(fd, sections[i].data, sections[i].size, header.section_offset[i], path);
+    }
+    write_at(fd, &header, sizeof(header), 0, path);
+}
+
+void WordNet::save_snapshot(const std::string & path) const
+{
+    // the image is written next to its destination and renamed, so readers never map a partial file
+    const std::string temp_path = path + ".tmp";
+    const int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot write WordNet snapshot " + temp_path);
+    }
+    try {
+        write_snapshot(fd, temp_path);
+    }
+    catch (...) {
+        ::close(fd);
+        throw;
+    }
+    if (::close(fd) != 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot write WordNet snapshot " + temp_path);
+    }
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot write WordNet snapshot " + path);
+    }
+}
+
+void WordNet::publish_shared(const std::string & name) const
+{
+    // a new object is created under the name, so processes attached to the old one are not disturbed
+    unpublish_shared(name);
+    const int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "cannot create shared memory " + name);
+    }
+    try {
+        write_snapshot(fd, name);
+    }
+    catch (...) {
+        ::close(fd);
+        ::shm_unlink(name.c_str());
+        throw;
+    }
+    ::close(fd);
+}
+
+void WordNet::unpublish_shared(const std::string & name)
+{
+    if (::shm_unlink(name.c_str()) != 0 && errno != ENOENT) {
+        throw std::system_error(errno, std::generic_category(), "cannot remove shared memory " + name);
+    }
+}
+
+WordNet WordNet::with_delta(const WordNetDelta & delta) const
+{
+    WordNetOptions options;
+    options.search_mode = search_mode;
+    WordNet result(options);
+    if (cache) {
+        result.cache = cache->clone_empty();
+    }
+
+    // vertices keep their indices and new synsets are appended after them
+    const unsigned old_size = graph.size();
+    Digraph next_graph = graph.unfrozen_copy();
+    for (std::size_t i = 0; i < delta.synsets.size(); ++i) {
+        if (next_graph.add_vertex(delta.synsets[i].id) != old_size + i) {
+            throw std::invalid_argument("WordNet: synset id " + std::to_string(delta.synsets[i].id) + " already exists");
+        }
+    }
+    for (const auto & [from, to] : delta.hypernyms) {
+        next_graph.graph[next_graph.vert(from)].push_back(next_graph.vert(to));
+    }
+    next_graph.freeze();
+    result.graph = std::move(next_graph);
+
+    // text is copied verbatim, so existing ranges stay valid, and new strings are appended to it
+    const bool shared_text = gloss_text.data() == text.data();
+    std::vector<char> nouns_text(text.begin(), text.end());
+    std::vector<char> glosses_text;
+    if (!shared_text) {
+        glosses_text.assign(gloss_text.begin(), gloss_text.end());
+    }
+    std::vector<char> & new_glosses_text = shared_text ? nouns_text : glosses_text;
+    const auto append = [](std::vector<char> & out, std::string_view str) {
+        const TextRef ref = {static_cast<unsigned>(out.size()), static_cast<unsigned>(str.size())};
+        out.insert(out.end(), str.begin(), str.end());
+        return ref;
+    };
+    std::vector<TextRef> gloss_refs(glosses.begin(), glosses.end());
+    gloss_refs.resize(old_size);
+    for (const WordNetDelta::Synset & synset : delta.synsets) {
+        gloss_refs.push_back(append(new_glosses_text, synset.gloss));
+    }
+
+    // new (noun, vertex) pairs are merged into the sorted noun table
+    std::vector<std::pair<std::string_view, unsigned>> added;
+    for (std::size_t i = 0; i < delta.synsets.size(); ++i) {
+        for (const std::string & noun : delta.synsets[i].nouns) {
+            added.emplace_back(noun, old_size + i);
+        }
+    }
+    for (const auto & [noun, id] : delta.nouns) {
+        added.emplace_back(noun, result.graph.vert(id));
+    }
+    std::stable_sort(added.begin(), added.end(), [](const auto & lhs, const auto & rhs) {
+        return lhs.first < rhs.first;
+    });
+    std::vector<TextRef> names;
+    names.reserve(noun_names.size() + added.size());
+    std::vector<unsigned> vert_offsets;
+    vert_offsets.reserve(noun_names.size() + added.size() + 1);
+    std::vector<unsigned> verts;
+    verts.reserve(noun_verts.size() + added.size());
+    std::vector<unsigned> noun_remap(noun_names.size()); // noun of this WordNet -> noun of the result
+    std::vector<char> noun_changed(noun_names.size(), 0); // noun of this WordNet that gains synsets
+    std::size_t old_noun = 0;
+    auto next_added = added.begin();
+    while (old_noun < noun_names.size() || next_added != added.end()) {
+        const bool is_old = old_noun < noun_names.size() &&
+                (next_added == added.end() || text_of(noun_names[old_noun]) <= next_added->first);
+        std::string_view name;
+        vert_offsets.push_back(verts.size());
+        if (is_old) {
+            name = text_of(noun_names[old_noun]);
+            noun_remap[old_noun] = names.size();
+            names.push_back(noun_names[old_noun]);
+            const VertexRange synsets = noun_synsets(NounId(old_noun));
+            verts.insert(verts.end(), synsets.begin(), synsets.end());
+        }
+        else {
+            name = next_added->first;
+            names.push_back(append(nouns_text, name));
+        }
+        for (; next_added != added.end() && next_added->first == name; ++next_added) {
+            if (std::find(verts.begin() + vert_offsets.back(), verts.end(), next_added->second) == verts.end()) {
+                verts.push_back(next_added->second);
+                if (is_old) {
+                    noun_changed[old_noun] = true;
+                }
+            }
+        }
+        if (is_old) {
+            ++old_noun;
+        }
+    }
+    vert_offsets.push_back(verts.size());
+
+    result.compact_nouns = std::move(nouns_text);
+    result.text = std::string_view(result.compact_nouns.data(), result.compact_nouns.size());
+    result.gloss_text = result.text;
+    if (!shared_text) {
+        result.owned_glosses = std::move(glosses_text);
+        result.gloss_text = std::string_view(result.owned_glosses.data(), result.owned_glosses.size());
+    }
+    result.noun_names = std::move(names);
+    result.noun_vert_offsets = std::move(vert_offsets);
+    result.noun_verts = std::move(verts);
+    result.glosses = std::move(gloss_refs);
+    result.index_vert_nouns();
+    result.index_folded_nouns();
+
+    // a new edge changes ancestors of its source and of everything below it, other vertices keep theirs
+    std::vector<char> stale(result.graph.size(), 0);
+    std::fill(stale.begin() + old_size, stale.end(), 1);
+    std::vector<unsigned> sources;
+    for (const auto & [from, to] : delta.hypernyms) {
+        sources.push_back(result.graph.vert(from));
+    }
+    DigraphTraversal::breadth_first<EdgeDirection::reverse>(result.graph, sources, local_workspace(), [&stale](unsigned vert, unsigned) {
+        stale[vert] = 1;
+    });
+
+    if (!labels.empty()) {
+        result.labels.update(labels, result.graph, stale, local_workspace());
+    }
+    if (cache) {
+        const auto unaffected = [&](unsigned noun) {
+            if (noun_changed[noun]) {
+                return false;
+            }
+            for (const unsigned vert : noun_synsets(NounId(noun))) {
+                if (stale[vert]) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        for (const ResultCache::Item & item : cache->items()) {
+            if (unaffected(item.noun1) && unaffected(item.noun2)) {
+                result.cache->insert(noun_remap[item.noun1], noun_remap[item.noun2], item.result);
+            }
+        }
+    }
+    return result;
+}
+
+unsigned WordNet::depth(NounId noun) const
+{
+    unsigned result = std::numeric_limits<unsigned>::max();
+    for (const unsigned vert : noun_synsets(noun)) {
+        result = std::min(result, graph.depths[vert]);
+    }
+    return result;
+}
+
+std::pair<unsigned, unsigned> WordNet::cached_sca_distance(NounId noun1, NounId noun2) const
+{
+    // the pair is searched in a canonical order, so a cached result does not depend on argument order
+    if (noun2.index < noun1.index) {
+        std::swap(noun1, noun2);
+    }
+    const VertexRange synsets1 = noun_synsets(noun1);
+    const VertexRange synsets2 = noun_synsets(noun2);
+    std::pair<unsigned, unsigned> found;
+    if (!cache || !cache->find(noun1.index, noun2.index, found)) {
+        WORDNET_COUNT(local_workspace().counters = {});
+        found = find_sca_distance(synsets1, synsets2);
+        WORDNET_COUNT(counters->add_search(local_workspace().counters));
+        if (cache) {
+            cache->insert(noun1.index, noun2.index, found);
+        }
+    }
+    return found;
+}
+
+WordNet::SCAResult WordNet::find_sca(NounId noun1, NounId noun2, WordNetStats::Api api) const
+{
+    const ApiTimer timer(counters.get(), api);
+    const auto [vert, distance] = cached_sca_distance(noun1, noun2);
+    return {gloss_of(vert), graph.id(vert), distance};
+}
+
+WordNet::Similarity WordNet::similarity(NounId noun1, NounId noun2) const
+{
+    const ApiTimer timer(counters.get(), WordNetStats::similarity_api);
+    const auto [vert, distance] = cached_sca_distance(noun1, noun2);
+    // depths are counted in synsets rather than edges, so that the root stays similar to itself
+    const double sca_depth = graph.depths[vert] + 1.0;
+    const double taxonomy_depth = graph.max_depth + 1.0;
+    Similarity result;
+    result.path = 1.0 / (distance + 1.0);
+    result.wu_palmer = 2.0 * sca_depth / (distance + 2.0 * sca_depth);
+    result.leacock_chodorow = -std::log((distance + 1.0) / (2.0 * taxonomy_depth));
+    return result;
+}
+
+WordNetStats WordNet::stats() const
+{
+    WordNetStats result;
+    if (!counters) {
+        return result;
+    }
+    result.enabled = true;
+    result.searches = counters->searches.load(std::memory_order_relaxed);
+    result.vertices_visited = counters->vertices_visited.load(std::memory_order_relaxed);
+    result.edges_scanned = counters->edges_scanned.load(std::memory_order_relaxed);
+    result.queue_peak = counters->queue_peak.load(std::memory_order_relaxed);
+    result.lookup_failures = counters->lookup_failures.load(std::memory_order_relaxed);
+    for (std::size_t api = 0; api < WordNetStats::api_count; ++api) {
+        result.latency[api].calls = counters->calls[api].load(std::memory_order_relaxed);
+        for (std::size_t bucket = 0; bucket < WordNetStats::latency_buckets; ++bucket) {
+            result.latency[api].histogram[bucket] = counters->latency[api][bucket].load(std::memory_order_relaxed);
+        }
+    }
+    return result;
+}
+
+std::vector<WordNet::NearNoun> WordNet::nearest(NounId noun, std::size_t k) const
+{
+    // a path between two nouns climbs hypernym edges to their common ancestor and then descends hyponym edges,
+    // so the search runs level by level on two layers: side 0 climbs from the synsets of 'noun' and every
+    // vertex it reaches also joins side 1 at the same distance, which descends along reverse edges
+    const ApiTimer timer(counters.get(), WordNetStats::nearest_api);
+    const VertexRange synsets = noun_synsets(noun);
+    SearchWorkspace & workspace = local_workspace();
+    workspace.start(graph.size());
+    SearchWorkspace::Side & up = workspace.sides[0];
+    SearchWorkspace::Side & down = workspace.sides[1];
+    for (const unsigned vert : synsets) {
+        if (!workspace.is_marked(0, vert)) {
+            workspace.mark(0, vert, 0);
+        }
+    }
+    std::vector<NearNoun> result;
+    std::unordered_set<unsigned> found = {noun.index};
+    for (unsigned distance = 0; result.size() < k; ++distance) {
+        const std::size_t up_end = up.queue_tail;
+        for (std::size_t i = up.queue_head; i < up_end; ++i) {
+            if (!workspace.is_marked(1, up.queue[i])) {
+                workspace.mark(1, up.queue[i], distance);
+            }
+        }
+        const std::size_t down_end = down.queue_tail;
+        if (up.queue_head == up_end && down.queue_head == down_end) {
+            break;
+        }
+        // every noun is reported at its first synset that is reached
+        for (std::size_t i = down.queue_head; i < down_end && result.size() < k; ++i) {
+            const unsigned vert = down.queue[i];
+            for (unsigned j = vert_noun_offsets[vert]; j < vert_noun_offsets[vert + 1] && result.size() < k; ++j) {
+                if (found.insert(vert_nouns[j]).second) {
+                    result.push_back({text_of(noun_names[vert_nouns[j]]), distance});
+                }
+            }
+        }
+        for (; up.queue_head < up_end; ++up.queue_head) {
+            for (const unsigned to : graph.neighbours(up.queue[up.queue_head])) {
+                if (!workspace.is_marked(0, to)) {
+                    workspace.mark(0, to, distance + 1);
+                }
+            }
+        }
+        for (; down.queue_head < down_end; ++down.queue_head) {
+            for (const unsigned to : graph.reverse_neighbours(down.queue[down.queue_head])) {
+                if (!workspace.is_marked(1, to)) {
+                    workspace.mark(1, to, distance + 1);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+void WordNet::path(NounId noun1, NounId noun2, std::vector<PathStep> & out) const
+{
+    const ApiTimer timer(counters.get(), WordNetStats::path_api);
+    // searched in the canonical order of cached_sca_distance(), so the path goes through the ancestor
+    // sca_id() and sca_view() report for the pair, even on ties
+    const bool swapped = noun2.index < noun1.index;
+    if (swapped) {
+        std::swap(noun1, noun2);
+    }
+    const VertexRange synsets1 = noun_synsets(noun1);
+    const VertexRange synsets2 = noun_synsets(noun2);
+    SearchWorkspace & workspace = local_workspace();
+    const ShortestCommonAncestor sca(graph, workspace, search_mode);
+    std::pair<unsigned, unsigned> found;
+    const bool cached = cache && cache->find(noun1.index, noun2.index, found);
+    WORDNET_COUNT(workspace.counters = {});
+    if (cached || !labels.empty()) {
+        // neither cached results nor labels keep parents, so both subsets climb to the known ancestor
+        if (!cached) {
+            found = find_sca_distance(synsets1, synsets2);
+        }
+        if (found.second == std::numeric_limits<unsigned>::max()) {
+            workspace.path.clear();
+        }
+        else {
+            sca.ancestor_path(synsets1, synsets2, found.first, workspace.path);
+        }
+    }
+    else {
+        // the search records parents, so the path is read off the search that finds the ancestor
+        found = sca.ancestor_path(synsets1, synsets2, workspace.path);
+    }
+    WORDNET_COUNT(counters->add_search(workspace.counters));
+    if (cache && !cached) {
+        cache->insert(noun1.index, noun2.index, found);
+    }
+    if (swapped) {
+        std::reverse(workspace.path.begin(), workspace.path.end());
+    }
+    out.clear();
+    for (const unsigned vert : workspace.path) {
+        out.push_back({graph.id(vert), gloss_of(vert)});
+    }
+}
+
+std::vector<unsigned> WordNet::distances(const std::vector<std::pair<std::string_view, std::string_view>> & pairs,
+                                        unsigned threads) const
+{
+    // workers grab blocks of consecutive pairs, so uneven query costs do not leave threads idle
+    constexpr std::size_t block_size = 256;
+    std::vector<unsigned> result(pairs.size());
+    parallel_for((pairs.size() + block_size - 1) / block_size, threads, [&](std::size_t block) {
+        // every worker thread searches with its own thread-local workspace
+        const std::size_t end = std::min((block + 1) * block_size, pairs.size());
+        for (std::size_t i = block * block_size; i < end; ++i) {
+            result[i] = find_sca(pairs[i].first, pairs[i].second, WordNetStats::distance_api).distance;
+        }
+    });
+    return result;
+}
+
+std::vector<std::vector<unsigned>> WordNet::distance_matrix(const std::vector<std::string_view> & nouns) const
+{
+    // one ancestor map per noun, all packed in one arena; every pair is answered by merging two maps
+    std::vector<AncestorLabels::Entry> maps;
+    std::vector<std::size_t> map_offsets;
+    ancestor_maps(nouns.data(), nouns.size(), maps, map_offsets);
+
+    std::vector<std::vector<unsigned>> result(nouns.size(), std::vector<unsigned>(nouns.size()));
+    for (std::size_t i = 0; i < nouns.size(); ++i) {
+        for (std::size_t j = i + 1; j < nouns.size(); ++j) {
+            unsigned min_distance = std::numeric_limits<unsigned>::max();
+            unsigned min_distance_ancestor = 0;
+            ShortestCommonAncestor::merge_ancestor_maps({maps.data() + map_offsets[i], maps.data() + map_offsets[i + 1]},
+                                                        {maps.data() + map_offsets[j], maps.data() + map_offsets[j + 1]},
+                                                        min_distance,
+                                                        min_distance_ancestor);
+            result[i][j] = min_distance;
+            result[j][i] = min_distance;
+        }
+    }
+    return result;
+}
+
+SearchWorkspace & WordNet::local_workspace()
+{
+    thread_local SearchWorkspace workspace;
+    return workspace;
+}
+
+LiveWordNet::LiveWordNet(WordNet wordnet)
+    : current(std::make_shared<const WordNet>(std::move(wordnet)))
+{
+}
+
+void LiveWordNet::apply(const WordNetDelta & delta)
+{
+    std::lock_guard<std::mutex> lock(update_mutex);
+    std::shared_ptr<const WordNet> next = std::make_shared<const WordNet>(get()->with_delta(delta));
+    std::atomic_store(&current, std::move(next));
+}
+
+std::string Outcast::outcast(const std::set<std::string> & nouns) const
+{
+    const std::vector<std::string_view> views(nouns.begin(), nouns.end());
+    return std::string(outcast(views.data(), views.size()));
+}
+
+std::string_view Outcast::outcast(const std::string_view * nouns, std::size_t count) const
+{
+    const std::size_t n = count;
+    if (n <= 2) {
+        return {};
+    }
+    // ancestor maps of all nouns packed in one arena, roots of every map in another one
+    std::vector<AncestorLabels::Entry> maps;
+    std::vector<AncestorLabels::Entry> roots;
+    std::vector<std::size_t> map_offsets;
+    std::vector<std::size_t> root_offsets(n + 1);
+    wordnet.ancestor_maps(nouns, n, maps, map_offsets);
+    for (std::size_t i = 0; i < n; ++i) {
+        root_offsets[i] = roots.size();
+        std::copy_if(maps.begin() + map_offsets[i], maps.begin() + map_offsets[i + 1], std::back_inserter(roots), [this](const AncestorLabels::Entry & entry) {
+            return wordnet.is_root(entry.ancestor);
+        });
+    }
+    root_offsets[n] = roots.size();
+    const auto map_of = [&](std::size_t i) -> WordNet::AncestorRange {
+        return {maps.data() + map_offsets[i], maps.data() + map_offsets[i + 1]};
+    };
+    const auto roots_of = [&](std::size_t i) -> WordNet::AncestorRange {
+        return {roots.data() + root_offsets[i], roots.data() + root_offsets[i + 1]};
+    };
+
+    // a path through a common root bounds the distance of a pair from above and 0 bounds it from below;
+    // sums are bounded by adding bounds of unmeasured pairs to the measured distances
+    std::vector<unsigned> upper(n * n);
+    std::vector<char> measured(n * n, false);
+    std::vector<std::uint64_t> lower_sum(n, 0);
+    std::vector<std::uint64_t> upper_sum(n, 0);
+    std::vector<std::size_t> unmeasured(n, n - 1);
+    std::vector<char> alive(n, true);
+    for (std::size_t i = 0; i < n; ++i) {
+        for (std::size_t j = i + 1; j < n; ++j) {
+            const unsigned bound = WordNet::merged_distance(roots_of(i), roots_of(j));
+            upper[i * n + j] = upper[j * n + i] = bound;
+            upper_sum[i] += bound;
+            upper_sum[j] += bound;
+        }
+    }
+
+    while (true) {
+        // a noun whose sum cannot reach the largest lower bound can be neither the outcast nor part of a tie
+        const std::uint64_t best_lower = *std::max_element(lower_sum.begin(), lower_sum.end());
+        std::size_t next = n;
+        for (std::size_t i = 0; i < n; ++i) {
+            if (alive[i] && upper_sum[i] < best_lower) {
+                alive[i] = false;
+            }
+            if (alive[i] && unmeasured[i] != 0 && (next == n || upper_sum[i] > upper_sum[next])) {
+                next = i;
+            }
+        }
+        if (next == n) {
+            break;
+        }
+        // the most promising noun gets its exact sum, which also tightens bounds of its partners
+        for (std::size_t j = 0; j < n; ++j) {
+            if (j == next || measured[next * n + j]) {
+                continue;
+            }
+            const unsigned distance = WordNet::merged_distance(map_of(next), map_of(j));
+            const unsigned slack = upper[next * n + j] - distance;
+            measured[next * n + j] = measured[j * n + next] = true;
+            for (const std::size_t k : {next, j}) {
+                lower_sum[k] += distance;
+                upper_sum[k] -= slack;
+                --unmeasured[k];
+            }
+        }
+    }
+
+    // sums of the remaining nouns are exact
+    std::size_t answer = n;
+    bool max_dist_was_repeated = false;
+    for (std::size_t i = 0; i < n; ++i) {
+        if (!alive[i]) {
+            continue;
+        }
+        if (answer == n || lower_sum[i] > lower_sum[answer]) {
+            answer = i;
+            max_dist_was_repeated = false;
+        }
+        else if (lower_sum[i] == lower_sum[answer]) {
+            max_dist_was_repeated = true;
+        }
+    }
+    return max_dist_was_repeated ? std::string_view() : nouns[answer];
+}
+
+unsigned OutcastSet::member_distance(const Member & a, const Member & b) const
+{
+    return WordNet::merged_distance({a.ancestors.data(), a.ancestors.data() + a.ancestors.size()},
+                                    {b.ancestors.data(), b.ancestors.data() + b.ancestors.size()});
+}
+
+bool OutcastSet::add(std::string_view noun)
+{
+    const WordNet::NounId id = wordnet.resolve_noun(noun);
+    for (const Member & member : members) {
+        if (member.noun == id) {
+            return false;
+        }
+    }
+    Member added{id, {}, 0};
+    wordnet.ancestor_map(wordnet.noun_synsets(id), added.ancestors);
+    for (Member & member : members) {
+        const unsigned distance = member_distance(added, member);
+        added.distance_sum += distance;
+        member.distance_sum += distance;
+    }
+    members.push_back(std::move(added));
+    return true;
+}
+
+bool OutcastSet::remove(std::string_view noun)
+{
+    const WordNet::NounId id = wordnet.noun_id(noun);
+    auto removed = std::find_if(members.begin(), members.end(), [id](const Member & member) {
+        return member.noun == id;
+    });
+    if (removed == members.end()) {
+        return false;
+    }
+    std::swap(*removed, members.back());
+    for (std::size_t i = 0; i + 1 < members.size(); ++i) {
+        members[i].distance_sum -= member_distance(members.back(), members[i]);
+    }
+    members.pop_back();
+    return true;
+}
+
+std::string_view OutcastSet::outcast() const
 {
-    if (nouns.size() <= 2) {
-        return "";
+    if (members.size() <= 2) {
+        return {};
     }
-    std::vector<unsigned> distances(nouns.size());
-    std::size_t answer_word_number = 0;
-    std::set<std::string>::iterator answer_word_iterator;
+    const Member * answer = &members.front();
     bool max_dist_was_repeated = false;
-    std::size_t first_pos = 0;
-    for (auto i = nouns.begin(); i != nouns.end(); ++i, ++first_pos) {
-        std::size_t second_pos = first_pos + 1;
-        for (auto j = std::next(i); j != nouns.end(); ++j, ++second_pos) {
-            unsigned distance = wordnet.distance(*i, *j);
-            distances[first_pos] += distance;
-            distances[second_pos] += distance;
-        }
-        if (distances[first_pos] > distances[answer_word_number] || first_pos == 0) {
-            answer_word_number = first_pos;
-            answer_word_iterator = i;
+    for (auto it = members.begin() + 1; it != members.end(); ++it) {
+        if (it->distance_sum > answer->distance_sum) {
+            answer = &*it;
             max_dist_was_repeated = false;
         }
-        else if (distances[first_pos] == distances[answer_word_number]) {
+        else if (it->distance_sum == answer->distance_sum) {
             max_dist_was_repeated = true;
         }
     }
-    return (max_dist_was_repeated ? "" : *answer_word_iterator);
+    return max_dist_was_repeated ? std::string_view() : wordnet.noun(answer->noun);
 }
@@ -0,0 +1,409 @@
+/**
+ * Command-line driver scoring noun pairs in batch.
+ *
+ * Build from the repository root:
+ *
+ *     g++ -std=c++17 -O2 -DNDEBUG -pthread -Iinclude tools/wordnet_cli.cpp src/wordnet.cpp -o wordnet_cli
+ *
+ * Usage:
+ *
+ *     wordnet_cli (--snapshot FILE | --shared NAME | --synsets FILE --hypernyms FILE) [options] [PAIRS]
+ *
+ *     --shared NAME         attach to a WordNet published in shared memory object NAME
+ *     --save-snapshot FILE  write a snapshot of the loaded WordNet and exit
+ *     --publish-shared NAME publish the loaded WordNet in shared memory object NAME and exit
+ *     --threads N           number of worker threads (default: one per hardware thread)
+ *     --block-size BYTES    size of input blocks handed to workers (default: 1 MiB)
+ *     --output FILE         write results to FILE instead of stdout
+ *
+ * PAIRS (stdin if omitted or "-") holds one tab-separated noun pair per line.
+ * For every pair a line "noun1 TAB noun2 TAB distance TAB sca" is written, in
+ * input order; distance and sca are empty if a noun is unknown.
+ *
+ * Input is processed by a pipeline: a reader cuts it into blocks on line
+ * boundaries, workers score whole blocks and a writer emits finished blocks in
+ * input order. At most two blocks per worker are in flight, so memory stays
+ * bounded whatever the input size, and output is written one block at a time
+ * without flushing per record.
+ */
+
+#include "wordnet.h"
+
+#include <charconv>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options
+{
+    std::string snapshot;
+    std::string shared;
+    std::string synsets;
+    std::string hypernyms;
+    std::string save_snapshot;
+    std::string publish_shared;
+    std::string input = "-";
+    std::string output;
+    unsigned threads = 0;
+    std::size_t block_size = 1 << 20;
+};
+
+[[noreturn]] void usage_error(const std::string & message)
+{
+    std::cerr << "wordnet_cli: " << message << "\n"
+              << "usage: wordnet_cli (--snapshot FILE | --shared NAME | --synsets FILE --hypernyms FILE)\n"
+              << "                   [--save-snapshot FILE] [--publish-shared NAME]\n"
+              << "                   [--threads N] [--block-size BYTES] [--output FILE] [PAIRS]\n";
+    std::exit(2);
+}
+
+// parses the value of a numeric option: decimal digits only, within the range of T
+template <class T>
+T parse_number(std::string_view option, const std::string & text)
+{
+    T number = 0;
+    const char * last = text.data() + text.size();
+    const auto [end, error] = std::from_chars(text.data(), last, number);
+    if (text.empty() || text[0] < '0' || text[0] > '9' || error != std::errc() || end != last) {
+        usage_error("invalid value of " + std::string(option) + ": " + text);
+    }
+    return number;
+}
+
+Options parse_options(int argc, char ** argv)
+{
+    Options options;
+    bool has_input = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const auto value = [&]() -> std::string {
+            if (i + 1 == argc) {
+                usage_error("missing value of " + std::string(arg));
+            }
+            return argv[++i];
+        };
+        if (arg == "--snapshot") {
+            options.snapshot = value();
+        }
+        else if (arg == "--shared") {
+            options.shared = value();
+        }
+        else if (arg == "--synsets") {
+            options.synsets = value();
+        }
+        else if (arg == "--hypernyms") {
+            options.hypernyms = value();
+        }
+        else if (arg == "--save-snapshot") {
+            options.save_snapshot = value();
+        }
+        else if (arg == "--publish-shared") {
+            options.publish_shared = value();
+        }
+        else if (arg == "--output") {
+            options.output = value();
+        }
+        else if (arg == "--threads") {
+            options.threads = parse_number<unsigned>(arg, value());
+        }
+        else if (arg == "--block-size") {
+            options.block_size = std::max<std::size_t>(1, parse_number<std::size_t>(arg, value()));
+        }
+        else if (arg.size() > 1 && arg[0] == '-' && arg != "-") {
+            usage_error("unknown option " + std::string(arg));
+        }
+        else if (!has_input) {
+            options.input = arg;
+            has_input = true;
+        }
+        else {
+            usage_error("more than one input file");
+        }
+    }
+    const int sources = !options.snapshot.empty() + !options.shared.empty() + !options.synsets.empty();
+    if (sources != 1 || options.synsets.empty() != options.hypernyms.empty()) {
+        usage_error("one of --snapshot, --shared or both --synsets and --hypernyms is required");
+    }
+    if (options.threads == 0) {
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return options;
+}
+
+// piece of input holding whole lines; workers replace its text with the output lines
+struct Block
+{
+    std::size_t index = 0;
+    std::string text;
+};
+
+// FIFO queue handing blocks between pipeline stages
+class BlockQueue
+{
+public:
+    void push(Block block)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            blocks.push_back(std::move(block));
+        }
+        ready.notify_one();
+    }
+
+    // takes the next block, returns 'false' once the queue is closed and empty
+    bool pop(Block & block)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this] {
+            return !blocks.empty() || closed;
+        });
+        if (blocks.empty()) {
+            return false;
+        }
+        block = std::move(blocks.front());
+        blocks.pop_front();
+        return true;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        ready.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<Block> blocks;
+    bool closed = false;
+};
+
+// counts blocks between the reader and the writer, so the reader waits while too many are in flight
+class InFlightLimit
+{
+public:
+    explicit InFlightLimit(std::size_t limit)
+        : available(limit)
+    {
+    }
+
+    void acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        released.wait(lock, [this] {
+            return available != 0;
+        });
+        --available;
+    }
+
+    void release()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++available;
+        }
+        released.notify_one();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable released;
+    std::size_t available;
+};
+
+// scores all lines of 'input' and returns the output lines
+std::string score_block(const WordNet & wordnet, std::string_view input)
+{
+    std::string output;
+    output.reserve(input.size() * 2);
+    std::size_t start = 0;
+    while (start < input.size()) {
+        std::size_t end = input.find('\n', start);
+        if (end == std::string_view::npos) {
+            end = input.size();
+        }
+        std::string_view line = input.substr(start, end - start);
+        start = end + 1;
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        if (line.empty()) {
+            continue;
+        }
+        const std::size_t tab = line.find('\t');
+        const std::string_view noun1 = line.substr(0, tab);
+        const std::string_view noun2 = tab == std::string_view::npos ? std::string_view() : line.substr(tab + 1);
+        output.append(noun1).append(1, '\t').append(noun2).append(1, '\t');
+        const WordNet::NounId id1 = wordnet.noun_id(noun1);
+        const WordNet::NounId id2 = wordnet.noun_id(noun2);
+        if (id1.valid() && id2.valid()) {
+            const WordNet::SCAResult result = wordnet.sca_distance(id1, id2);
+            output.append(std::to_string(result.distance)).append(1, '\t').append(result.gloss);
+        }
+        else {
+            output.append(1, '\t');
+        }
+        output.append(1, '\n');
+    }
+    return output;
+}
+
+WordNet load(const Options & options)
+{
+    if (!options.snapshot.empty()) {
+        return WordNet::open_snapshot(options.snapshot);
+    }
+    if (!options.shared.empty()) {
+        return WordNet::attach_shared(options.shared);
+    }
+    WordNetOptions load_options;
+    load_options.load_threads = options.threads;
+    return WordNet::from_files(options.synsets, options.hypernyms, load_options);
+}
+
+void run_pipeline(const WordNet & wordnet, const Options & options, std::FILE * in, std::FILE * out)
+{
+    BlockQueue input_blocks;
+    BlockQueue output_blocks;
+    InFlightLimit in_flight(2 * static_cast<std::size_t>(options.threads));
+    std::exception_ptr failure;
+    std::mutex failure_mutex;
+    const auto fail = [&](std::exception_ptr error) {
+        std::lock_guard<std::mutex> lock(failure_mutex);
+        if (!failure) {
+            failure = error;
+        }
+    };
+
+    std::thread reader([&] {
+        // blocks are cut after the last complete line, the rest is carried over to the next block
+        std::string carry;
+        std::size_t index = 0;
+        std::vector<char> buffer(options.block_size);
+        while (true) {
+            const std::size_t read = std::fread(buffer.data(), 1, buffer.size(), in);
+            if (read == 0) {
+                break;
+            }
+            carry.append(buffer.data(), read);
+            const std::size_t last_newline = carry.rfind('\n');
+            if (last_newline == std::string::npos) {
+                continue;
+            }
+            Block block;
+            block.index = index++;
+            block.text = carry.substr(0, last_newline + 1);
+            carry.erase(0, last_newline + 1);
+            in_flight.acquire();
+            input_blocks.push(std::move(block));
+        }
+        if (std::ferror(in)) {
+            fail(std::make_exception_ptr(std::runtime_error("cannot read input")));
+        }
+        if (!carry.empty()) {
+            Block block;
+            block.index = index++;
+            block.text = std::move(carry);
+            in_flight.acquire();
+            input_blocks.push(std::move(block));
+        }
+        input_blocks.close();
+    });
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < options.threads; ++i) {
+        workers.emplace_back([&] {
+            Block block;
+            while (input_blocks.pop(block)) {
+                try {
+                    block.text = score_block(wordnet, block.text);
+                }
+                catch (...) {
+                    fail(std::current_exception());
+                    block.text.clear();
+                }
+                output_blocks.push(std::move(block));
+            }
+        });
+    }
+
+    std::thread writer([&] {
+        // blocks finish out of order and wait here until all blocks before them are written
+        std::map<std::size_t, std::string> finished;
+        std::size_t next = 0;
+        Block block;
+        while (output_blocks.pop(block)) {
+            finished.emplace(block.index, std::move(block.text));
+            for (auto it = finished.begin(); it != finished.end() && it->first == next; it = finished.erase(it), ++next) {
+                if (std::fwrite(it->second.data(), 1, it->second.size(), out) != it->second.size()) {
+                    fail(std::make_exception_ptr(std::runtime_error("cannot write output")));
+                }
+                in_flight.release();
+            }
+        }
+    });
+
+    reader.join();
+    for (std::thread & worker : workers) {
+        worker.join();
+    }
+    output_blocks.close();
+    writer.join();
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
+
+} // namespace
+
+int main(int argc, char ** argv)
+{
+    const Options options = parse_options(argc, argv);
+    try {
+        const WordNet wordnet = load(options);
+        if (!options.save_snapshot.empty() || !options.publish_shared.empty()) {
+            if (!options.save_snapshot.empty()) {
+                wordnet.save_snapshot(options.save_snapshot);
+            }
+            if (!options.publish_shared.empty()) {
+                wordnet.publish_shared(options.publish_shared);
+            }
+            return 0;
+        }
+        std::FILE * in = options.input == "-" ? stdin : std::fopen(options.input.c_str(), "rb");
+        if (in == nullptr) {
+            throw std::runtime_error("cannot open " + options.input);
+        }
+        std::FILE * out = options.output.empty() ? stdout : std::fopen(options.output.c_str(), "wb");
+        if (out == nullptr) {
+            throw std::runtime_error("cannot open " + options.output);
+        }
+        run_pipeline(wordnet, options, in, out);
+        if (std::fflush(out) != 0 || (out != stdout && std::fclose(out) != 0)) {
+            throw std::runtime_error("cannot write output");
+        }
+        if (in != stdin) {
+            std::fclose(in);
+        }
+    }
+    catch (const std::exception & e) {
+        std::cerr << "wordnet_cli: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}